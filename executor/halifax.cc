@@ -27,15 +27,26 @@
  */
 class Halifax : public InstructionCache, public StaticReceiver<Halifax>
 {
+  DBus<CpuMessage> &_executor_bios;
+  bool _revoked;
 public:
   bool  receive(CpuMessage &msg)
   {
+    // the revocation may arrive while we block in an instruction
+    if (msg.type == CpuMessage::TYPE_REVOKE_MEMREGION) { _revoked = true; return true; }
     if (msg.type != CpuMessage::TYPE_SINGLE_STEP) return false;
+
+    // the virtual BIOS is only asked at its entry points
+    if (VCpu::in_bios_window(msg.cpu) && _executor_bios.send(msg, true)) return true;
+    if (_revoked) {
+      _revoked = false;
+      invalidate_regions();
+    }
     step(msg);
     return true;
   }
 
-  Halifax(VCpu *vcpu) : InstructionCache(vcpu) {
+  Halifax(VCpu *vcpu) : InstructionCache(vcpu), _executor_bios(vcpu->executor_bios), _revoked(false) {
     vcpu->executor.add(this,  receive_static);
   }
   void *operator new(size_t size)  { return new /*(__alignof__(Halifax))*/ char[size]; }
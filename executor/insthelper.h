@@ -320,6 +320,53 @@ helper_SDT(SGDT,gd, MTD_GDTR)
     _vcpu->executor.send(msg, true);
   }
 
+  /**
+   * Move the elements of a REP INS/OUTS that are in the current page
+   * of guest RAM with a single string message.  Returns the number of
+   * elements the device took.  On zero the caller does a single
+   * element, which also raises any fault.
+   */
+  template<unsigned operand_size>
+  unsigned __attribute__((regparm(3)))  helper_string_io(bool is_in)
+  {
+    unsigned count = _entry->address_size == 1 ? _cpu->cx : _cpu->ecx;
+    if (!(_entry->prefixes & 0xff) || _cpu->efl & 0x400 || count < 2) return 0;
+
+    CpuState::Descriptor *desc = is_in ? &_cpu->es : (&_cpu->es) + ((_entry->prefixes >> 8) & 0xf);
+    unsigned virt = is_in ? _cpu->edi : _cpu->esi;
+    if (_entry->address_size == 1) virt &= 0xffff;
+    unsigned left = 0x1000 - ((desc->base + virt) & 0xfff);
+    if (_entry->address_size == 1 && left > 0x10000 - virt) left = 0x10000 - virt;
+
+    // expand-down segments and limit violations are left to the single elements
+    if ((desc->ar & 0xc) == 4 || virt > desc->limit) return 0;
+    if (desc->limit - virt < left - 1) left = desc->limit - virt + 1;
+    if (count > (left >> operand_size)) count = left >> operand_size;
+    if (count < 2) return 0;
+
+    unsigned len = count << operand_size;
+    Type type = user_access(is_in ? TYPE_W : TYPE_R);
+    if (handle_segment(desc, virt, len, is_in, false)) return 0;
+    char *ptr = direct_virtual(virt, len, type);
+    if (!ptr) return 0;
+
+    // XXX check IOPBM
+    CpuMessage msg(is_in, _cpu, operand_size, _cpu->dx, ptr, _mtr_in, count);
+    _vcpu->executor.send(msg, true);
+
+    unsigned done = count - msg.io_count;
+    unsigned size = done << operand_size;
+    if (_entry->address_size == 1) {
+      _cpu->cx -= done;
+      if (is_in) _cpu->di += size; else _cpu->si += size;
+    }
+    else {
+      _cpu->ecx -= done;
+      if (is_in) _cpu->edi += size; else _cpu->esi += size;
+    }
+    return done;
+  }
+
 /**
  * Calc the flags for an operation.
  */
@@ -351,8 +398,16 @@ int calc_flags(unsigned operand_size, void *src, void *dst) {
   template<unsigned feature, unsigned operand_size>
   int __attribute__((regparm(3)))  string_helper()
   {
+    bool string_io = feature & (SH_DOOP_IN | SH_DOOP_OUT);
     while (_entry->address_size == 1 && _cpu->cx || _entry->address_size == 2 && _cpu->ecx || !(_entry->prefixes & 0xff))
       {
+	// whole pages at once, until a device does not take a string
+	if (string_io) {
+	  if (helper_string_io<operand_size>(feature & SH_DOOP_IN)) continue;
+	  NCHECK(_fault);
+	  string_io = false;
+	}
+
 	void *src = &_cpu->eax;
 	void *dst = &_cpu->eax;
 
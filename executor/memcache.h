@@ -45,6 +45,8 @@ class MemCache
 protected:
   DBus<MessageMem>       &_mem;
   DBus<MessageMemRegion> &_memregion;
+  TprShadow              &_tpr;
+  DBus<LapicEvent>       &_bus_lapic;
   unsigned  _fault;
   unsigned  _error_code;
   unsigned  _debug_fault_line;
@@ -119,16 +121,45 @@ private:
   unsigned _newest_write;
 
 
+  /**
+   * Access the TPR shadow instead of the LAPIC.
+   */
+  void tpr_io(bool read, unsigned *ptr) {
+    if (read)
+      *ptr = _tpr.value;
+    else if (_tpr.write(*ptr & 0xff)) {
+      LapicEvent msg(LapicEvent::TPR);
+      _bus_lapic.send(msg, true);
+    }
+  }
+
+
+  /**
+   * Transfer a buffer with naturally aligned accesses that are as
+   * wide as possible. Wide accesses that no device handles are split
+   * into dwords.
+   */
   void buffer_io(bool read, unsigned index) {
     assert(!(_buffers[index]._len & 3));
     assert(!(_buffers[index]._phys1 & 3));
 
     uintptr_t address = _buffers[index]._phys1;
-    for (size_t i=0; i < _buffers[index]._len; i += 4) {
-      MessageMem msg2(read, address, reinterpret_cast<unsigned *>(_buffers[index].data + i));
-      _mem.send(msg2, true);
-      if ((address & 0xfff) != 0xffc)
-	address += 4;
+    for (size_t i=0; i < _buffers[index]._len; ) {
+      size_t len = 4;
+      while (len < MessageMem::MAX_LEN && !(address & (2*len - 1))
+	     && i + 2*len <= _buffers[index]._len && (address & 0xfff) + 2*len <= 0x1000)
+	len *= 2;
+
+      MessageMem msg2(read, address, reinterpret_cast<unsigned *>(_buffers[index].data + i), len);
+      if (len == 4 || in_range(_tpr.phys, address, len) || !_mem.send(msg2, true))
+	for (size_t j = 0; j < len; j += 4) {
+	  MessageMem msg3(read, address + j, reinterpret_cast<unsigned *>(_buffers[index].data + i + j));
+	  if (address + j == _tpr.phys) tpr_io(read, msg3.ptr); else _mem.send(msg3, true);
+	}
+
+      i += len;
+      if ((address & 0xfff) != 0x1000 - len)
+	address += len;
       else
 	address = _buffers[index]._phys2;
     }
@@ -263,6 +294,31 @@ public:
   }
 
 
+  /**
+   * A direct reference to len bytes of memory or null if they are
+   * not backed by a memory region.  This bypasses the buffers.
+   */
+  char *direct(uintptr_t phys, size_t len)
+  {
+    MessageMemRegion msg(phys >> 12);
+    if (!_memregion.send(msg, true) || !msg.ptr || (phys + len) > ((msg.start_page + msg.count) << 12)) return 0;
+    return msg.ptr + (phys - (msg.start_page << 12));
+  }
+
+
+  /**
+   * Forget the direct memory references, as a region handed out via
+   * MessageMemRegion was revoked.  Not allowed in the middle of an
+   * instruction.
+   */
+  void invalidate_regions()
+  {
+    for (unsigned j = 0; j < SIZE; j++)
+      for (unsigned i = 0; i < ASSOZ; i++)
+	_sets[j]._values[i]._ptr = 0;
+  }
+
+
   /**
    * Invalidate the cache, thus writeback the buffers.
    */
@@ -276,7 +332,8 @@ public:
     }
 
 
-  MemCache(DBus<MessageMem> &mem, DBus<MessageMemRegion> &memregion) : _mem(mem), _memregion(memregion), _fault(), _error_code(), _debug_fault_line(), _mtr_in(), _mtr_read(), _mtr_out(), debug(false), _sets()
+  MemCache(DBus<MessageMem> &mem, DBus<MessageMemRegion> &memregion, TprShadow &tpr, DBus<LapicEvent> &bus_lapic)
+    : _mem(mem), _memregion(memregion), _tpr(tpr), _bus_lapic(bus_lapic), _fault(), _error_code(), _debug_fault_line(), _mtr_in(), _mtr_read(), _mtr_out(), debug(false), _sets()
   {
     assert(ASSOZ   >= 2);
     assert(BUFFERS >= 2);
@@ -195,6 +195,19 @@ protected:
   }
 
 
+  /**
+   * A direct reference to len bytes of memory within a page, or null
+   * if they are MMIO or the translation faults.
+   */
+  char *direct_virtual(uintptr_t virt, size_t len, Type type)
+  {
+    uintptr_t phys;
+    assert(!((virt ^ (virt + len - 1)) & ~0xffful));
+    if (virt_to_phys(virt, type, phys)) return 0;
+    return direct(phys, len);
+  }
+
+
   int prepare_virtual(uintptr_t virt, size_t len, Type type, void *&ptr)
   {
     bool round = (virt | len) & 3;
@@ -207,5 +220,6 @@ protected:
   }
 
 
-  MemTlb(DBus<MessageMem> &mem, DBus<MessageMemRegion> &memregion) : MemCache(mem, memregion), _cpu(), _pdpt(), _msr_efer(), _paging_mode(), tlb_fill_func() {}
+  MemTlb(DBus<MessageMem> &mem, DBus<MessageMemRegion> &memregion, TprShadow &tpr, DBus<LapicEvent> &bus_lapic)
+    : MemCache(mem, memregion, tpr, bus_lapic), _cpu(), _pdpt(), _msr_efer(), _paging_mode(), tlb_fill_func() {}
 };
@@ -22,8 +22,13 @@
 
 /**
  * Virtual Bios disk routines.
- * Features: int13, boot from disk
+ * Features: int13, boot from disk, sequential read-ahead
  * Missing: multiple disks
+ *
+ * Sequential reads are detected and the following sectors are read
+ * ahead into a buffer in guest memory that is hidden from the
+ * guest. Subsequent INT13 reads are answered from this buffer without
+ * a disk request.
  */
 class VirtualBiosDisk : public StaticReceiver<VirtualBiosDisk>, public BiosCommon
 {
@@ -31,16 +36,38 @@ class VirtualBiosDisk : public StaticReceiver<VirtualBiosDisk>, public BiosCommo
   {
     MAX_DISKS  = 8,
     MAGIC_DISK_TAG = ~0u,
+    PREFETCH_TAG = ~1u,
     FREQ = 1000,
     DISK_TIMEOUT = 5000,
     DISK_COMPLETION_CODE = 0x79,
     DISK_COUNT = 0x75,
     WAKEUP_IRQ = 1,
   };
+public:
+  enum {
+    PREFETCH_SECTORS = 128,
+    PREFETCH_SIZE    = PREFETCH_SECTORS * 512,
+  };
+private:
   unsigned _timer;
   DiskParameter _disk_params[MAX_DISKS];
   unsigned _disk_count;
   bool _diskop_inprogress;
+  bool _diskop_waiting;  ///< the BIOS waits for the wakeup irq
+
+  // read-ahead state
+  enum {
+    PREFETCH_NONE,
+    PREFETCH_PENDING,
+    PREFETCH_STALE,
+    PREFETCH_VALID,
+  } _prefetch_state;
+  char     *_prefetch_buffer;
+  uintptr_t _prefetch_phys;
+  unsigned  _prefetch_disk;
+  unsigned long long _prefetch_block;
+  unsigned long long _last_block;     ///< the block after the last read
+  unsigned  _last_disk;
 
   void init_params() {
     // get sectors of the disk
@@ -60,33 +87,109 @@ class VirtualBiosDisk : public StaticReceiver<VirtualBiosDisk>, public BiosCommo
     return false;
   }
 
+  /**
+   * Is the block range completely in the read-ahead buffer?
+   */
+  bool in_prefetch(unsigned disk_nr, unsigned long long blocknr, size_t count)
+  {
+    return _prefetch_state == PREFETCH_VALID && disk_nr == _prefetch_disk
+      && blocknr >= _prefetch_block && blocknr + count <= _prefetch_block + PREFETCH_SECTORS;
+  }
+
+
+  /**
+   * Start reading ahead the sectors following blocknr.
+   */
+  void prefetch(unsigned disk_nr, unsigned long long blocknr)
+  {
+    if (!_prefetch_buffer || _prefetch_state == PREFETCH_PENDING || _prefetch_state == PREFETCH_STALE
+	|| blocknr + PREFETCH_SECTORS > _disk_params[disk_nr].sectors)
+      return;
+
+    DmaDescriptor dma;
+    dma.bytecount  = PREFETCH_SIZE;
+    dma.byteoffset = _prefetch_phys;
+
+    _prefetch_state = PREFETCH_PENDING;
+    _prefetch_disk  = disk_nr;
+    _prefetch_block = blocknr;
+    MessageDisk msg(MessageDisk::DISK_READ, disk_nr, PREFETCH_TAG, blocknr, 1, &dma, 0, ~0ul);
+    if (!_mb.bus_disk.send(msg) || msg.error)
+      _prefetch_state = PREFETCH_NONE;
+  }
+
+
+  /**
+   * Forget the read-ahead.  A pending one is ignored when it completes.
+   */
+  void drop_prefetch()
+  {
+    if (_prefetch_state == PREFETCH_PENDING) _prefetch_state = PREFETCH_STALE;
+    if (_prefetch_state == PREFETCH_VALID)   _prefetch_state = PREFETCH_NONE;
+  }
+
+
+  /**
+   * Return the completion code of a finished disk operation.
+   */
+  bool disk_done(MessageBios &msg)
+  {
+    msg.cpu->ah = read_bda(DISK_COMPLETION_CODE);
+    msg.mtr_out |= MTD_GPR_ACDB;
+    return true;
+  }
+
+
   /**
    * Read/Write disk helper.
    */
   bool disk_op(MessageBios &msg, unsigned disk_nr, unsigned long long blocknr, uintptr_t address, size_t count, bool write)
   {
+    bool sequential = disk_nr == _last_disk && blocknr == _last_block;
+    _last_disk  = disk_nr;
+    _last_block = blocknr + count;
+
+    // writes drop the read-ahead in receive(MessageDisk)
+    if (!write && count && in_prefetch(disk_nr, blocknr, count)) {
+      COUNTER_INC("int13 prefetched");
+      copy_out(address, _prefetch_buffer + (blocknr - _prefetch_block) * 512, count * 512);
+      msg.cpu->ah = 0;
+      msg.mtr_out |= MTD_GPR_ACDB;
+
+      // keep one buffer ahead of the reader
+      if (blocknr + count == _prefetch_block + PREFETCH_SECTORS)
+	prefetch(disk_nr, blocknr + count);
+      return true;
+    }
+
     DmaDescriptor dma;
     dma.bytecount  = 512*count;
     dma.byteoffset = address;
 
+    // Backends like host/virtualdisk.cc complete the request before
+    // the send returns, others like unix/main.cc queue it.
+    _diskop_inprogress = true;
     MessageDisk msg2(write ? MessageDisk::DISK_WRITE : MessageDisk::DISK_READ, disk_nr, MAGIC_DISK_TAG, blocknr, 1, &dma, 0, ~0ul);
     if (!_mb.bus_disk.send(msg2) || msg2.error)
       {
+	_diskop_inprogress = false;
 	Logging::printf("msg2.error %x\n", msg2.error);
 	error(msg, 0x01);
 	return true;
       }
-    else
-      {
-	_diskop_inprogress = true;
 
-	// wait for completion needed for AHCI backend!
-	// prog timeout during wait
-	MessageTimer msg3(_timer, _mb.clock()->abstime(DISK_TIMEOUT, FREQ));
-	_mb.bus_timer.send(msg3);
+    if (!write && sequential) prefetch(disk_nr, blocknr + count);
 
-	return jmp_int(msg, 0x76);
-      }
+    // already completed, no need to wait
+    if (!_diskop_inprogress) return disk_done(msg);
+
+    // wait for completion needed for AHCI backend!
+    // prog timeout during wait
+    _diskop_waiting = true;
+    MessageTimer msg3(_timer, _mb.clock()->abstime(DISK_TIMEOUT, FREQ));
+    _mb.bus_timer.send(msg3);
+
+    return jmp_int(msg, 0x76);
   }
 
 
@@ -245,17 +348,56 @@ class VirtualBiosDisk : public StaticReceiver<VirtualBiosDisk>, public BiosCommo
 
 public:
 
+  /**
+   * Watch the disk writes of all models, e.g. AHCI and IDE, as
+   * they make the buffered sectors stale.
+   */
+  bool  receive(MessageDisk &msg)
+  {
+    if (msg.type != MessageDisk::DISK_WRITE || msg.disknr != _prefetch_disk) return false;
+
+    unsigned long long bytes = 0;
+    for (unsigned i = 0; i < msg.dmacount; i++) bytes += msg.dma[i].bytecount;
+    if (msg.sector < _prefetch_block + PREFETCH_SECTORS && msg.sector + (bytes + 511) / 512 > _prefetch_block)
+      drop_prefetch();
+    return false;
+  }
+
+
+  /**
+   * A reset of the machine or the CPU restarts the BIOS.
+   */
+  bool  receive(MessageLegacy &msg)
+  {
+    if (msg.type != MessageLegacy::RESET && msg.type != MessageLegacy::INIT) return false;
+    drop_prefetch();
+    _last_block = ~0ull;
+    _last_disk  = ~0u;
+    return false;
+  }
+
+
   /**
    * Get disk commit.
    */
   bool  receive(MessageDiskCommit &msg)
   {
+    if (msg.usertag == PREFETCH_TAG) {
+      bool valid = _prefetch_state == PREFETCH_PENDING && msg.status == MessageDisk::DISK_OK;
+      _prefetch_state = valid ? PREFETCH_VALID : PREFETCH_NONE;
+      return true;
+    }
     if (msg.usertag == MAGIC_DISK_TAG) {
 	write_bda(DISK_COMPLETION_CODE, msg.status, 1);
 	if (_diskop_inprogress) {
 	  _diskop_inprogress = false;
-	  MessageIrqLines msg2(MessageIrq::ASSERT_IRQ, WAKEUP_IRQ);
-	  _mb.bus_irqlines.send(msg2);
+
+	  // a synchronous completion is returned by disk_op() directly
+	  if (_diskop_waiting) {
+	    _diskop_waiting = false;
+	    MessageIrqLines msg2(MessageIrq::ASSERT_IRQ, WAKEUP_IRQ);
+	    _mb.bus_irqlines.send(msg2);
+	  }
 	  return true;
 	}
     }
@@ -274,6 +416,7 @@ public:
 	Logging::printf("BIOS disk timeout\n");
 	write_bda(DISK_COMPLETION_CODE, 1, 1);
 	_diskop_inprogress = false;
+	_diskop_waiting    = false;
 
 	// send a message to wakeup the client
 	MessageIrqLines msg2(MessageIrq::ASSERT_IRQ, WAKEUP_IRQ);
@@ -295,22 +438,25 @@ public:
 	msg.cpu->efl |= 0x200;
 	return jmp_int(msg, 0x76);
       }
-      msg.cpu->ah = read_bda(DISK_COMPLETION_CODE);
-      msg.mtr_out |= MTD_GPR_ACDB;
-      return true;
+      return disk_done(msg);
     default:    return false;
     }
   }
 
 
-  VirtualBiosDisk(Motherboard &mb) : BiosCommon(mb), _disk_params(), _diskop_inprogress() {
+  VirtualBiosDisk(Motherboard &mb, char *prefetch_buffer, uintptr_t prefetch_phys)
+    : BiosCommon(mb), _disk_params(), _diskop_inprogress(), _diskop_waiting(), _prefetch_state(PREFETCH_NONE),
+      _prefetch_buffer(prefetch_buffer), _prefetch_phys(prefetch_phys), _prefetch_disk(~0u), _prefetch_block(),
+      _last_block(~0ull), _last_disk(~0u) {
     mb.bus_diskcommit.add(this,  VirtualBiosDisk::receive_static<MessageDiskCommit>);
     mb.bus_timeout.add(this,     VirtualBiosDisk::receive_static<MessageTimeout>);
+    mb.bus_disk.add(this,        VirtualBiosDisk::receive_static<MessageDisk>);
+    mb.bus_legacy.add(this,      VirtualBiosDisk::receive_static<MessageLegacy>);
 
     _disk_count = ~0u;
 
     // get timer
-    MessageTimer msg0;
+    MessageTimer msg0(this, VirtualBiosDisk::receive_static<MessageTimeout>);
     if (!mb.bus_timer.send(msg0))
       Logging::panic("%s can't get a timer", __PRETTY_FUNCTION__);
     _timer = msg0.nr;
@@ -323,6 +469,17 @@ public:
 PARAM_HANDLER(vbios_disk,
 	      "vbios_disk- provide disk related virtual BIOS functions.")
 {
-  mb.bus_bios.add(new VirtualBiosDisk(mb), VirtualBiosDisk::receive_static<MessageBios>);
+  MessageHostOp msg1(MessageHostOp::OP_ALLOC_FROM_GUEST, (unsigned long)VirtualBiosDisk::PREFETCH_SIZE);
+  MessageHostOp msg2(MessageHostOp::OP_GUEST_MEM, 0UL);
+  char     *buffer = 0;
+  uintptr_t phys   = 0;
+  if (mb.bus_hostop.send(msg1) && mb.bus_hostop.send(msg2) && msg2.ptr) {
+    buffer = msg2.ptr + msg1.phys;
+    phys   = msg1.phys;
+  }
+  else
+    Logging::printf("%s no read-ahead buffer\n", __PRETTY_FUNCTION__);
+
+  mb.bus_bios.add(new VirtualBiosDisk(mb, buffer, phys), VirtualBiosDisk::receive_static<MessageBios>, 0x13, 0x19, 0x76);
 }
 
@@ -275,7 +275,7 @@ public:
     _hostmb->bus_hostop .add(this, receive_static<MessageHostOp>);
     _hostmb->bus_hwioin .add(this, receive_static<MessageHwIOIn>);
     _hostmb->bus_hwioout.add(this, receive_static<MessageHwIOOut>);
-    _mb.bus_bios        .add(this, receive_static<MessageBios>);
+    _mb.bus_bios        .add(this, receive_static<MessageBios>, 0x09, 0x16, RESET_VECTOR);
     _mb.bus_discovery   .add(this, receive_static<MessageDiscovery>);
     _hostmb->handle_arg("hostkeyb:0x10,0x60,1,,1");
 
@@ -162,6 +162,6 @@ public:
 PARAM_HANDLER(vbios_mem,
 	      "vbios_mem - provide memory related virtual BIOS functions.")
 {
-  mb.bus_bios.add(new VirtualBiosMem(mb), VirtualBiosMem::receive_static<MessageBios>);
+  mb.bus_bios.add(new VirtualBiosMem(mb), VirtualBiosMem::receive_static<MessageBios>, 0x11, 0x12, 0x15, 0x17);
 }
 
@@ -26,7 +26,12 @@
  *
  * State: unstable
  * Features: CPU init, elf-decoding, MBI creation, memory-map, request
- *           modules from sigma0, modaddr
+ *           modules from sigma0, modaddr, direct boot
+ *
+ * In direct boot mode the kernel and the MBI are prepared when the
+ * machine is reset and the CPU is started in protected mode at the
+ * reset vector. The BIOS reset code and the table discovery are not
+ * executed.
  */
 class VirtualBiosMultiboot : public StaticReceiver<VirtualBiosMultiboot>, BiosCommon
 {
@@ -85,6 +90,11 @@ public:
 private:
   uintptr_t _modaddr;
   unsigned _lowmem;
+  bool _direct;
+
+  // kernel prepared for a direct boot
+  uintptr_t _direct_rip;
+  unsigned long _direct_mbi;
 
   /**
    * Initialize an MBI from the hip.
@@ -140,8 +150,8 @@ private:
 
     if (!m) return 0;
 
-    // provide memory map
-    if (discovery_read_dw("bda", 0x13, _lowmem))
+    // provide memory map, the BDA is only initialized by the BIOS reset code
+    if (!_direct && discovery_read_dw("bda", 0x13, _lowmem))
       _lowmem = (_lowmem & 0xffff) << 10;
 
     MbiMmap mymap[] = {{20, 0, _lowmem, 0x1},
@@ -158,17 +168,11 @@ private:
   };
 
 
- public:
-  bool  receive(MessageBios &msg) {
-
-    if (msg.irq != 0x19) return false;
-    Logging::printf(">\t%s rip %x ilen %zx cr0 %zx efl %zx\n", __PRETTY_FUNCTION__,
-		    msg.cpu->eip, size_t(msg.cpu->inst_len), size_t(msg.cpu->cr0), size_t(msg.cpu->efl));
-
+  /**
+   * Start the kernel in flat protected mode.
+   */
+  bool start_kernel(MessageBios &msg, uintptr_t rip, unsigned long mbi) {
     long long tsc_off = msg.cpu->tsc_off;
-    uintptr_t rip = 0xfffffff0;
-    unsigned long mbi;
-    if (!(mbi = init_mbi(rip)))  return false;
 
     msg.cpu->clear();
     msg.cpu->eip      = rip;
@@ -193,7 +197,45 @@ private:
     return true;
   }
 
-  VirtualBiosMultiboot(Motherboard &mb, uintptr_t modaddr, unsigned lowmem) : BiosCommon(mb), _modaddr(modaddr), _lowmem(lowmem) {}
+
+ public:
+  bool  receive(MessageBios &msg) {
+
+    if (msg.irq != 0x19 && msg.irq != DIRECT_BOOT) return false;
+    Logging::printf(">\t%s rip %x ilen %zx cr0 %zx efl %zx\n", __PRETTY_FUNCTION__,
+		    msg.cpu->eip, size_t(msg.cpu->inst_len), size_t(msg.cpu->cr0), size_t(msg.cpu->efl));
+
+    uintptr_t rip = 0xfffffff0;
+    unsigned long mbi;
+    if (msg.irq == DIRECT_BOOT && _direct_mbi) {
+      // use the image prepared during reset only once
+      rip = _direct_rip;
+      mbi = _direct_mbi;
+      _direct_mbi = 0;
+    }
+    else if (!(mbi = init_mbi(rip)))  return false;
+
+    // the reset code did not run, thus do its LAPIC, PIT and PIC init
+    if (msg.irq == DIRECT_BOOT) init_platform(msg);
+
+    return start_kernel(msg, rip, mbi);
+  }
+
+
+  /**
+   * Load the kernel and build the MBI already when the machine is
+   * reset, thus before the first instruction is executed.
+   */
+  bool  receive(MessageLegacy &msg) {
+    if (msg.type != MessageLegacy::RESET) return false;
+
+    _direct_rip = 0xfffffff0;
+    _direct_mbi = init_mbi(_direct_rip);
+    return false;
+  }
+
+  VirtualBiosMultiboot(Motherboard &mb, uintptr_t modaddr, unsigned lowmem, bool direct)
+    : BiosCommon(mb), _modaddr(modaddr), _lowmem(lowmem), _direct(direct), _direct_rip(), _direct_mbi() {}
 };
 
 
@@ -202,15 +244,27 @@ PARAM_HANDLER(vbios_multiboot_modaddr,
 	      "vbios_multiboot_modaddr:modaddr - override the default modaddr parameter of vbios_multiboot")
 {_vbios_multiboot_modaddr = argv[0];}
 
+bool _vbios_multiboot_direct;
+PARAM_HANDLER(vbios_multiboot_direct,
+	      "vbios_multiboot_direct - override the default direct parameter of vbios_multiboot")
+{_vbios_multiboot_direct = argv[0] == ~0ul || argv[0];}
+
 PARAM_HANDLER(vbios_multiboot,
-	      "vbios_multiboot:modaddr=0x1800000,lowmem=0xa0000 - create a BIOS extension that supports multiboot",
+	      "vbios_multiboot:modaddr=0x1800000,lowmem=0xa0000,direct=0 - create a BIOS extension that supports multiboot",
 	      "Example:  'vbios_multiboot'",
 	      "modaddr defines where the modules are loaded in guest memory.",
-	      "lowmem allows to restrict memory below 1M to less than 640k.")
+	      "lowmem allows to restrict memory below 1M to less than 640k.",
+	      "direct boots the kernel without running the BIOS reset code.")
 {
-  mb.bus_bios.add(new VirtualBiosMultiboot(mb,
-					   argv[0]!= ~0ul ? argv[0] : _vbios_multiboot_modaddr,
-					   argv[1]!= ~0ul ? argv[1] : 0xa0000),
-		  VirtualBiosMultiboot::receive_static);
+  bool direct = argv[2]!= ~0ul ? argv[2] : _vbios_multiboot_direct;
+  VirtualBiosMultiboot *dev = new VirtualBiosMultiboot(mb,
+						       argv[0]!= ~0ul ? argv[0] : _vbios_multiboot_modaddr,
+						       argv[1]!= ~0ul ? argv[1] : 0xa0000,
+						       direct);
+  mb.bus_bios.add(dev, VirtualBiosMultiboot::receive_static<MessageBios>, 0x19);
+  if (direct) {
+    mb.bus_bios.add(dev, VirtualBiosMultiboot::receive_static<MessageBios>, MessageBios::DIRECT_BOOT);
+    mb.bus_legacy.add(dev, VirtualBiosMultiboot::receive_static<MessageLegacy>);
+  }
 }
  
@@ -28,6 +28,9 @@ PARAM_HANDLER(x2apic_mode,
  * Virtual Bios reset routines.
  * Features: init of PIC, PIT, bda+ebda, ACPI tables
  * Missing: flexible ACPI table size
+ *
+ * The ACPI checksums are only fixed once at the end of the discovery
+ * phase and not on every write.
  */
 class VirtualBiosReset : public StaticReceiver<VirtualBiosReset>, public BiosCommon
 {
@@ -46,15 +49,18 @@ class VirtualBiosReset : public StaticReceiver<VirtualBiosReset>, public BiosCom
 
   char     *_mem_ptr;
   size_t    _mem_size;
+  bool      _defer_checksums;
 
   struct Resource {
     const char *name;
     size_t offset;
     size_t length;
     bool     acpi_table;
+    bool     dirty;          ///< the checksum needs to be fixed
     Resource() {}
-    Resource(const char *_name, size_t _offset, size_t _length, bool _acpi_table) : name(_name), offset(_offset), length(_length), acpi_table(_acpi_table)  {}
+    Resource(const char *_name, size_t _offset, size_t _length, bool _acpi_table) : name(_name), offset(_offset), length(_length), acpi_table(_acpi_table), dirty()  {}
   } _resources[MAX_RESOURCES];
+  Resource *_last_resource;
 
 
 
@@ -64,68 +70,12 @@ class VirtualBiosReset : public StaticReceiver<VirtualBiosReset>, public BiosCom
    */
   bool reset_helper(MessageBios &msg)
   {
-    CpuState *state = msg.cpu;
-    VCpu *vcpu = msg.vcpu;
-
-    bool bsp = !vcpu->get_last();
-
-    // the APIC
-    state->eax = 0xfee00800 | (bsp ? 0x100U : 0U);
-    state->edx = 0;
-    state->ecx = 0x1b;
-    CpuMessage msg1(CpuMessage::TYPE_WRMSR, state, MTD_GPR_ACDB);
-    vcpu->executor.send(msg1, true);
-
-
-    // enable SVR, LINT0, LINT1
-    unsigned m[] = { 0x1ff, bsp ? 0x700U : 0x10700U, 0x400};
-    MessageMem msg2[] = {
-      MessageMem(false, 0xfee000f0, m+0),
-      MessageMem(false, 0xfee00350, m+1),
-      MessageMem(false, 0xfee00360, m+2),
-    };
-    for (unsigned j=0; j < sizeof(msg2) / sizeof(*msg2); j++)  vcpu->mem.send(msg2[j], true);
-
-
-    // switch to x2apic mode?
-    if (use_x2apic_mode) {
-      state->eax = 0xfee00c00 | (bsp ? 0x100 : 0);
-      vcpu->executor.send(msg1, true);
-    }
-
-
-    if (!bsp) return jmp_hlt(msg);
-
-    // we are a BSP and init the platform
-
-    // initialize PIT0
-    // let counter0 count with minimal freq of 18.2hz
-    outb(0x40+3, 0x24);
-    outb(0x40+0, 0);
-
-    // let counter1 generate 15usec refresh cycles
-    outb(0x40+3, 0x56);
-    outb(0x40+1, 0x12);
-
-    // the master PIC
-    // ICW1-4+IMR
-    outb(0x20+0, 0x11);
-    outb(0x20+1, 0x08); // offset 0x08
-    outb(0x20+1, 0x04); // has slave on 2
-    outb(0x20+1, 0x0f); // is buffer, master, AEOI and x86
-    outb(0x20+1, 0xfc); // TIMER+keyboard IRQ needed
-
-    // the slave PIC + IMR
-    outb(0xa0+0, 0x11);
-    outb(0xa0+1, 0x70); // offset 0x70
-    outb(0xa0+1, 0x02); // is slave on 2
-    outb(0xa0+1, 0x0b); // is buffer, slave, AEOI and x86
-    outb(0xa0+1, 0xff);
-
-
+    // APs wait for their INIT-SIPI sequence
+    if (!init_platform(msg)) return jmp_hlt(msg);
 
     // INIT resources
     memset(_resources, 0, sizeof(_resources));
+    _last_resource = 0;
 
     MessageMemRegion msg3(0);
     check1(false, !_mb.bus_memregion.send(msg3) || !msg3.ptr || !msg3.count, "no low memory available");
@@ -138,6 +88,7 @@ class VirtualBiosReset : public StaticReceiver<VirtualBiosReset>, public BiosCom
     if (_mem_size > 0xa0000) _mem_size = 0xa0000;
 
     // trigger discovery
+    _defer_checksums = true;
     MessageDiscovery msg4;
     _mb.bus_discovery.send_fifo(msg4);
 
@@ -146,6 +97,9 @@ class VirtualBiosReset : public StaticReceiver<VirtualBiosReset>, public BiosCom
 
     // store what remains on memory in KB
     discovery_write_dw("bda", 0x13, _mem_size >> 10, 2);
+
+    fix_dirty_checksums();
+    _defer_checksums = false;
     return jmp_int(msg, 0x19);
   }
 
@@ -163,9 +117,13 @@ class VirtualBiosReset : public StaticReceiver<VirtualBiosReset>, public BiosCom
 
 
   Resource * get_resource(const char *name) {
+    // writes to the same resource come in batches
+    if (_last_resource && (_last_resource->name == name || !strcmp(_last_resource->name, name)))
+      return _last_resource;
+
     for (unsigned i = 0; i < MAX_RESOURCES; i++) {
       check1(0, !_resources[i].name && !create_resource(i, name), "could not create resource");
-      if (!strcmp(_resources[i].name, name)) return _resources + i;
+      if (!strcmp(_resources[i].name, name)) return _last_resource = _resources + i;
     }
     return 0;
   }
@@ -183,6 +141,15 @@ class VirtualBiosReset : public StaticReceiver<VirtualBiosReset>, public BiosCom
   }
 
 
+  void fix_dirty_checksums() {
+    for (unsigned i = 0; i < MAX_RESOURCES && _resources[i].name; i++)
+      if (_resources[i].dirty) {
+	fix_acpi_checksum(_resources + i, acpi_tablesize(_resources + i));
+	_resources[i].dirty = false;
+      }
+  }
+
+
   void init_acpi_table(const char *name) {
     discovery_write_st(name,  0, name, 4);
     discovery_write_dw(name,  8, 1, 1);
@@ -272,16 +239,17 @@ public:
         check1(false, !(r = get_resource(msg.resource)));
         check1(false, needed_len > r->length, "WRITE no idea how to increase the table %s size from %zu to %zu", msg.resource, r->length, needed_len);
 
-        size_t table_len = acpi_tablesize(r);
-        // increase the length of an ACPI table.
-        if (r->acpi_table && msg.offset >= 8 && needed_len > table_len) {
-          discovery_write_dw(r->name, 4, needed_len, 4);
-          table_len = needed_len;
-        }
         memcpy(_mem_ptr + r->offset + msg.offset, msg.data, msg.count);
+        if (!r->acpi_table) break;
+
+        // increase the length of an ACPI table in place
+        unsigned *table_len = reinterpret_cast<unsigned *>(_mem_ptr + r->offset + 4);
+        if (msg.offset >= 8 && needed_len > *table_len)
+          *table_len = needed_len;
 
         // and fix the checksum
-        if (r->acpi_table)   fix_acpi_checksum(r, table_len);
+        r->dirty = true;
+        if (!_defer_checksums) fix_dirty_checksums();
       }
       break;
     case MessageDiscovery::READ:
@@ -301,13 +269,13 @@ public:
   }
 
 
-  VirtualBiosReset(Motherboard &mb) : BiosCommon(mb), _mem_ptr(), _mem_size(), _resources() {}
+  VirtualBiosReset(Motherboard &mb) : BiosCommon(mb), _mem_ptr(), _mem_size(), _defer_checksums(), _resources(), _last_resource() {}
 };
 
 PARAM_HANDLER(vbios_reset,
 	      "vbios_reset - provide reset handling for virtual BIOS functions.")
 {
   VirtualBiosReset * dev = new VirtualBiosReset(mb);
-  mb.bus_bios.add(dev,      VirtualBiosReset::receive_static<MessageBios>);
+  mb.bus_bios.add(dev,      VirtualBiosReset::receive_static<MessageBios>, VirtualBiosReset::RESET_VECTOR, 0x18);
   mb.bus_discovery.add(dev, VirtualBiosReset::receive_static<MessageDiscovery>);
 }
@@ -101,7 +101,7 @@ public:
 PARAM_HANDLER(vbios_time,
 	      "vbios_time - provide time related virtual BIOS functions.")
 {
-  mb.bus_bios.add(new VirtualBiosTime(mb), VirtualBiosTime::receive_static<MessageBios>);
+  mb.bus_bios.add(new VirtualBiosTime(mb), VirtualBiosTime::receive_static<MessageBios>, 0x08, 0x1a, 0x1c);
 }
 
 
@@ -18,6 +18,8 @@
 #pragma once
 #include "nul/vcpu.h"
 
+extern bool use_x2apic_mode;
+
 #define DEBUG(cpu)   Logging::printf("\t%s eax %x ebx %x ecx %x edx %x eip %x efl %x\n", __func__, cpu->eax, cpu->ebx, cpu->ecx, cpu->edx, cpu->eip, cpu->efl)
 
 class BiosCommon : public DiscoveryHelper<BiosCommon>
@@ -26,8 +28,9 @@ public:
   Motherboard &_mb;
 
   enum {
-    RESET_VECTOR = 0x100,
-    MAX_VECTOR
+    RESET_VECTOR = MessageBios::RESET_VECTOR,
+    DIRECT_BOOT  = MessageBios::DIRECT_BOOT,
+    MAX_VECTOR   = MessageBios::MAX_VECTOR
   };
 
 protected:
@@ -96,5 +99,71 @@ protected:
     _mb.bus_ioout.send(msg);
   }
 
+  /**
+   * Init the LAPIC of the CPU and on the BSP also the PIT and the
+   * PICs.  Returns true on the BSP.
+   */
+  bool init_platform(MessageBios &msg)
+  {
+    CpuState *state = msg.cpu;
+    VCpu *vcpu = msg.vcpu;
+
+    bool bsp = !vcpu->get_last();
+
+    // the APIC
+    state->eax = 0xfee00800 | (bsp ? 0x100U : 0U);
+    state->edx = 0;
+    state->ecx = 0x1b;
+    CpuMessage msg1(CpuMessage::TYPE_WRMSR, state, MTD_GPR_ACDB);
+    vcpu->executor.send(msg1, true);
+
+
+    // enable SVR, LINT0, LINT1
+    unsigned m[] = { 0x1ff, bsp ? 0x700U : 0x10700U, 0x400};
+    MessageMem msg2[] = {
+      MessageMem(false, 0xfee000f0, m+0),
+      MessageMem(false, 0xfee00350, m+1),
+      MessageMem(false, 0xfee00360, m+2),
+    };
+    for (unsigned j=0; j < sizeof(msg2) / sizeof(*msg2); j++)  vcpu->mem.send(msg2[j], true);
+
+
+    // switch to x2apic mode?
+    if (use_x2apic_mode) {
+      state->eax = 0xfee00c00 | (bsp ? 0x100 : 0);
+      vcpu->executor.send(msg1, true);
+    }
+
+
+    if (!bsp) return false;
+
+    // we are a BSP and init the platform
+
+    // initialize PIT0
+    // let counter0 count with minimal freq of 18.2hz
+    outb(0x40+3, 0x24);
+    outb(0x40+0, 0);
+
+    // let counter1 generate 15usec refresh cycles
+    outb(0x40+3, 0x56);
+    outb(0x40+1, 0x12);
+
+    // the master PIC
+    // ICW1-4+IMR
+    outb(0x20+0, 0x11);
+    outb(0x20+1, 0x08); // offset 0x08
+    outb(0x20+1, 0x04); // has slave on 2
+    outb(0x20+1, 0x0f); // is buffer, master, AEOI and x86
+    outb(0x20+1, 0xfc); // TIMER+keyboard IRQ needed
+
+    // the slave PIC + IMR
+    outb(0xa0+0, 0x11);
+    outb(0xa0+1, 0x70); // offset 0x70
+    outb(0xa0+1, 0x02); // is slave on 2
+    outb(0xa0+1, 0x0b); // is buffer, slave, AEOI and x86
+    outb(0xa0+1, 0xff);
+    return true;
+  }
+
  BiosCommon(Motherboard &mb) : _mb(mb), _bus_memregion(&mb.bus_memregion), _bus_mem(&mb.bus_mem) {}
 };
@@ -0,0 +1,102 @@
+/** @file
+ * Lost-tick policy for periodic timers.
+ *
+ * Economic rights: Technische Universitaet Dresden (Germany)
+ *
+ * This file is part of Vancouver.
+ *
+ * Vancouver is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Vancouver is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#pragma once
+#include "nul/timer.h"
+
+/**
+ * Decides what happens to the ticks of a periodic timer that could
+ * not be delivered in time, e.g. because the host timer fired late or
+ * the guest did not acknowledge the previous tick.
+ *
+ * The ticks lie on a grid with the given period.  The edge is the grid
+ * position of the last delivered tick and is owned by the timer.
+ */
+class TickPolicy
+{
+public:
+  enum Mode {
+    DISCARD,  ///< drop ticks that missed their period, even the late one
+    MERGE,    ///< deliver all missed ticks as a single one
+    DELAY,    ///< deliver every tick, the following ones are shifted
+    CATCHUP,  ///< deliver missed ticks faster until back on the grid
+    MODES,
+  };
+  enum {
+    CATCHUP_RATE = 4,  ///< how much faster missed ticks are delivered
+    MAX_BACKLOG  = 64, ///< missed ticks beyond this are dropped
+  };
+
+private:
+  unsigned  _mode;
+  timevalue _last;     ///< time of the last delivery
+
+public:
+  unsigned long long missed;  ///< how often the timer was a period behind
+  unsigned long long lost;    ///< ticks that were never delivered
+
+  /**
+   * Should a tick be delivered at now?  Moves the edge accordingly.
+   */
+  bool due(timevalue &edge, timevalue period, timevalue now)
+  {
+    if (now < edge + period) return false;
+
+    timevalue n = (now - edge) / period;
+    if (n > 1) missed++;
+    switch (_mode) {
+    case DISCARD:
+      edge += n * period;
+      if (n == 1) break;
+      lost += n;
+      return false;
+    case MERGE:
+      edge += n * period;
+      lost += n - 1;
+      break;
+    case DELAY:
+      edge  = now;
+      break;
+    case CATCHUP:
+      if (now < _last + period / CATCHUP_RATE) return false;
+      if (n > MAX_BACKLOG) {
+        lost += n - MAX_BACKLOG;
+        edge += (n - MAX_BACKLOG) * period;
+      }
+      edge += period;
+      break;
+    }
+    _last = now;
+    return true;
+  }
+
+  /**
+   * The time when the next tick will be due.
+   */
+  timevalue next(timevalue edge, timevalue period, timevalue now)
+  {
+    timevalue res = edge + period;
+    if (_mode == CATCHUP && res < _last + period / CATCHUP_RATE)
+      res = _last + period / CATCHUP_RATE;
+    return res < now ? now : res;
+  }
+
+  TickPolicy(unsigned mode = MERGE) : _mode(mode), _last(0), missed(0), lost(0)
+  {
+    if (mode >= MODES) Logging::panic("invalid tick policy %u\n", mode);
+  }
+};
@@ -40,7 +40,9 @@ public:
 template <class M>
 class DBus
 {
+public:
   typedef bool (*ReceiveFunction)(Device *, M&);
+private:
   struct Entry
   {
     Device *_dev;
@@ -140,3 +142,172 @@ public:
   /** Default constructor. */
   DBus() : _debug_counter(0), _list_count(0), _list_size(0), _list(nullptr) {}
 };
+
+
+/**
+ * A bus that is split by a key that is known when the devices are
+ * attached. A message only reaches the devices that registered for
+ * its key instead of all devices on the bus.
+ */
+template <class M, unsigned KEYS>
+class DBusTable
+{
+  DBus<M> _keys[KEYS];
+
+public:
+
+  void add(Device *dev, typename DBus<M>::ReceiveFunction func, unsigned key)
+  {
+    assert(key < KEYS);
+    _keys[key].add(dev, func);
+  }
+
+  /**
+   * Attach a device for multiple keys.
+   */
+  template <typename... MORE>
+  void add(Device *dev, typename DBus<M>::ReceiveFunction func, unsigned key, MORE... more)
+  {
+    add(dev, func, key);
+    add(dev, func, more...);
+  }
+
+  /**
+   * Send message LIFO to the devices of the given key.
+   */
+  bool send(unsigned key, M &msg, bool earlyout = false)
+  {
+    return key < KEYS && _keys[key].send(msg, earlyout);
+  }
+
+  /**
+   * Attach a device for a range of keys.
+   */
+  void add_range(Device *dev, typename DBus<M>::ReceiveFunction func, unsigned key, unsigned count)
+  {
+    for (unsigned i = 0; i < count; i++)
+      add(dev, func, key + i);
+  }
+
+  unsigned count(unsigned key) { return key < KEYS ? _keys[key].count() : 0; }
+
+  void debug_dump()
+  {
+    for (unsigned i = 0; i < KEYS; i++)
+      if (_keys[i].count()) {
+	Logging::printf("key %#x ", i);
+	_keys[i].debug_dump();
+      }
+  }
+};
+
+
+/**
+ * A bus for interrupt lines. Controllers and sources attach for the
+ * lines they are wired to, so that a message only reaches the
+ * devices of its lines. The message names its lines with
+ * line_base() and the bitmask line_mask().
+ */
+template <class M, unsigned LINES>
+class DBusLines : public DBusTable<M, LINES>
+{
+public:
+  bool send(M &msg, bool earlyout = false)
+  {
+    bool res = false;
+    for (unsigned mask = msg.line_mask(); mask && !(earlyout && res); mask &= mask - 1)
+      res |= DBusTable<M, LINES>::send(msg.line_base() + __builtin_ctz(mask), msg, earlyout);
+    return res;
+  }
+};
+
+
+/**
+ * A bus for I/O ports. Devices with fixed ports attach only for them
+ * and are called directly when one of their ports is accessed.
+ * Devices that decode ports that the guest can move, e.g. through a
+ * PCI BAR, attach without ports and see every access.
+ *
+ * A port may additionally have a fast reader.  It is called first and
+ * must neither have side effects nor rely on a lock held by the
+ * caller, e.g. by reading a snapshot under a SeqLock.  If it declines
+ * the message, the devices of the port get it as usual.
+ */
+template <class M>
+class DBusPorts : public DBus<M>
+{
+  enum {
+    PORTS = 1 << 16,
+    PAGE  = 256,
+  };
+  struct Fast {
+    Device *dev;
+    typename DBus<M>::ReceiveFunction func;
+  };
+  DBus<M> **_pages[PORTS / PAGE];
+  Fast     *_fast[PORTS / PAGE];
+
+public:
+  using DBus<M>::add;
+
+  /**
+   * Attach a device for count ports starting at port.
+   */
+  void add(Device *dev, typename DBus<M>::ReceiveFunction func, unsigned port, unsigned count)
+  {
+    if (port >= PORTS || count > PORTS - port) {
+      add(dev, func);
+      return;
+    }
+    for (; count--; port++) {
+      DBus<M> **&page = _pages[port / PAGE];
+      if (!page) {
+	page = new DBus<M> *[PAGE];
+	memset(page, 0, PAGE * sizeof(*page));
+      }
+      if (!page[port % PAGE]) page[port % PAGE] = new DBus<M>;
+      page[port % PAGE]->add(dev, func);
+    }
+  }
+
+  /**
+   * Attach the fast reader of a port.
+   */
+  void add_fast(Device *dev, typename DBus<M>::ReceiveFunction func, unsigned port)
+  {
+    if (port >= PORTS) return;
+    Fast *&page = _fast[port / PAGE];
+    if (!page) {
+      page = new Fast[PAGE];
+      memset(page, 0, PAGE * sizeof(*page));
+    }
+    assert(!page[port % PAGE].func);
+    page[port % PAGE].dev  = dev;
+    page[port % PAGE].func = func;
+  }
+
+  /**
+   * Try the fast reader of the port.
+   */
+  bool send_fast(M &msg)
+  {
+    Fast *page = _fast[msg.port / PAGE];
+    return page && page[msg.port % PAGE].func && page[msg.port % PAGE].func(page[msg.port % PAGE].dev, msg);
+  }
+
+  /**
+   * Send message to the fast reader of the port, otherwise LIFO to
+   * the devices of the port and then to the devices without ports.
+   */
+  bool send(M &msg, bool earlyout = false)
+  {
+    if (send_fast(msg)) return true;
+
+    DBus<M> **page = _pages[msg.port / PAGE];
+    bool res = page && page[msg.port % PAGE] && page[msg.port % PAGE]->send(msg, earlyout);
+    if (earlyout && res) return true;
+    return DBus<M>::send(msg, earlyout) || res;
+  }
+
+  DBusPorts() : _pages(), _fast() {}
+};
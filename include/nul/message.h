@@ -28,6 +28,12 @@
 /****************************************************/
 /**
  * An in() from an ioport.
+ *
+ * If count is set, this is a string transfer of count elements to
+ * ptr.  A device that takes it moves as many elements as it can at
+ * once, advancing ptr and decrementing count.  Devices without
+ * string support have to reject it, so that the sender falls back
+ * to single elements.
  */
 struct MessageIOIn
 {
@@ -53,7 +59,7 @@ struct MessageHwIOIn : public MessageIOIn {
 
 
 /**
- * An out() to an ioport.
+ * An out() to an ioport.  See MessageIOIn for string transfers.
  */
 struct MessageIOOut {
   enum Type {
@@ -82,19 +88,26 @@ struct MessageHwIOOut : public MessageIOOut {
 /****************************************************/
 
 /**
- * A dword aligned memory access.
+ * A naturally aligned memory access of len bytes.
+ *
+ * Accesses wider than a dword are only handled by devices that opt
+ * in by checking len. All others have to reject them, so that the
+ * sender falls back to dword accesses.
  */
 struct MessageMem
 {
   enum {
     MSI_ADDRESS = 0xfee00000,
     MSI_DM      = 1 << 2,
-    MSI_RH      = 1 << 3
+    MSI_RH      = 1 << 3,
+    MAX_LEN     = 64
   };
   bool read;
   uintptr_t phys;
   unsigned *ptr;
-  MessageMem(bool _read, uintptr_t _phys, unsigned *_ptr) : read(_read), phys(_phys), ptr(_ptr) {}
+  unsigned len;
+  bool wide() const { return len != 4; }
+  MessageMem(bool _read, uintptr_t _phys, unsigned *_ptr, unsigned _len = 4) : read(_read), phys(_phys), ptr(_ptr), len(_len) {}
 };
 
 /**
@@ -184,7 +197,10 @@ struct MessageIrq
       DEASSERT_IRQ
     } type;
   unsigned char line;
+  enum { LINES = 256 };
 
+  unsigned line_base() const { return line; }
+  unsigned line_mask() const { return 1; }
   MessageIrq(Type _type, unsigned char _line) :  type(_type), line(_line) {}
 };
 
@@ -199,6 +215,8 @@ struct MessageIrqNotify
 {
   unsigned char baseirq;
   unsigned char mask;
+  unsigned line_base() const { return baseirq; }
+  unsigned line_mask() const { return mask; }
   MessageIrqNotify(unsigned char _baseirq, unsigned char _mask) : baseirq(_baseirq), mask(_mask)  {}
 };
 
@@ -449,6 +467,7 @@ struct MessageHostOp
       OP_VCPU_BLOCK,
       OP_VCPU_RELEASE,
       OP_WAIT_CHILD,
+      OP_REVOKE_MEMREGION, ///< take back ptr+len, handed out for guest-physical value via MessageMemRegion
     } type;
   union {
     unsigned long value;
@@ -658,6 +677,12 @@ class CpuState;
 
 struct MessageBios
 {
+  enum {
+    BIOS_BASE    = 0xf0000, ///< the realmode vectors point to BIOS_BASE + vector
+    RESET_VECTOR = 0x100,
+    DIRECT_BOOT,            ///< asked before the reset vector, replaces the BIOS boot
+    MAX_VECTOR
+  };
   VCpu *vcpu;
   CpuState *cpu;
   unsigned irq;
@@ -680,6 +705,8 @@ typedef unsigned long long timevalue;
  * There is no frequency and clock here, as all is based on the same
  * clocksource.
  */
+class Device;
+struct MessageTimeout;
 struct MessageTimer
 {
   enum Type
@@ -689,7 +716,16 @@ struct MessageTimer
     } type;
   unsigned  nr;
   timevalue abstime;
-  MessageTimer()              : type(TIMER_NEW) {}
+
+  /**
+   * The optional owner of a new timer. A frontend can deliver the
+   * timeouts directly to it instead of using the timeout bus.
+   */
+  Device   *dev;
+  bool    (*func)(Device *, MessageTimeout &);
+
+  MessageTimer()              : type(TIMER_NEW), dev(0), func(0) {}
+  MessageTimer(Device *_dev, bool (*_func)(Device *, MessageTimeout &)) : type(TIMER_NEW), dev(_dev), func(_func) {}
   MessageTimer(unsigned  _nr, timevalue _abstime) : type(TIMER_REQUEST_TIMEOUT), nr(_nr), abstime(_abstime) {}
 };
 
@@ -28,6 +28,9 @@
 
 class VCpu;
 
+typedef DBusLines<MessageIrqLines,  MessageIrq::LINES> DBusIrqLines;
+typedef DBusLines<MessageIrqNotify, MessageIrq::LINES> DBusIrqNotify;
+
 /**
  * A virtual motherboard is a collection of busses.
  * The devices are later attached to the busses. To find out what the
@@ -50,20 +53,20 @@ class Motherboard
   DBus<MessageAcpi>         bus_acpi;
   DBus<MessageAhciSetDrive> bus_ahcicontroller;
   DBus<MessageApic>         bus_apic;
-  DBus<MessageBios>         bus_bios;
+  DBusTable<MessageBios, MessageBios::MAX_VECTOR> bus_bios; ///< BIOS services by realmode vector
   DBus<MessageConsole>      bus_console;
   DBus<MessageDiscovery>    bus_discovery;
   DBus<MessageDisk>         bus_disk;
   DBus<MessageDiskCommit>   bus_diskcommit;
   DBus<MessageHostOp>       bus_hostop;
   DBus<MessageHwIOIn>       bus_hwioin;	    ///< HW I/O space reads
-  DBus<MessageIOIn>         bus_ioin;       ///< I/O space reads from virtual machines
+  DBusPorts<MessageIOIn>    bus_ioin;       ///< I/O space reads from virtual machines
   DBus<MessageHwIOOut>      bus_hwioout;    ///< HW I/O space writes
-  DBus<MessageIOOut>        bus_ioout;	    ///< I/O space writes from virtual machines
+  DBusPorts<MessageIOOut>   bus_ioout;	    ///< I/O space writes from virtual machines
   DBus<MessageInput>        bus_input;
   DBus<MessageIrq>          bus_hostirq;    ///< Host IRQs
-  DBus<MessageIrqLines>	    bus_irqlines;   ///< Virtual IRQs before they reach (virtual) IRQ controller
-  DBus<MessageIrqNotify>    bus_irqnotify;
+  DBusIrqLines              bus_irqlines;   ///< Virtual IRQs before they reach (virtual) IRQ controller
+  DBusIrqNotify             bus_irqnotify;  ///< Level-triggered IRQs that can be reraised
   DBus<MessageLegacy>       bus_legacy;
   DBus<MessageMem>          bus_mem;	    ///< Access to memory from virtual devices
   DBus<MessageMemRegion>    bus_memregion;  ///< Access to memory pages from virtual devices
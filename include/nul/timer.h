@@ -25,17 +25,24 @@ typedef unsigned long long timevalue;
 /**
  * A clock returns the time in different time domains.
  *
- * The reference clock is the CPUs TSC.
+ * The reference clock is the CPUs TSC.  A frontend may advance the
+ * clock beyond the TSC to skip time where nothing happens.
  */
 class Clock
 {
  protected:
   timevalue _source_freq;
+  timevalue _skew;
  public:
 #ifdef TESTING
   virtual
 #endif
-  timevalue time() { return Cpu::rdtsc(); }
+  timevalue time() { return Cpu::rdtsc() + __atomic_load_n(&_skew, __ATOMIC_RELAXED); }
+
+  /**
+   * Advance the clock by delta TSC ticks.
+   */
+  void advance(timevalue delta) { __atomic_fetch_add(&_skew, delta, __ATOMIC_RELAXED); }
 
   /**
    * Returns the current clock in freq-time.
@@ -68,7 +75,7 @@ class Clock
     return Math::muldiv128(theabstime - now, freq, _source_freq);
   }
 
-  Clock(timevalue source_freq) : _source_freq(source_freq) {}
+  Clock(timevalue source_freq) : _source_freq(source_freq), _skew(0) {}
 };
 
 
@@ -36,7 +36,8 @@ struct CpuMessage {
     TYPE_WBINVD,
     TYPE_CHECK_IRQ,
     TYPE_CALC_IRQWINDOW,
-    TYPE_SINGLE_STEP
+    TYPE_SINGLE_STEP,
+    TYPE_REVOKE_MEMREGION ///< a MessageMemRegion answer is void, drop direct references to it
   } type;
   union {
     struct {
@@ -47,6 +48,7 @@ struct CpuMessage {
           unsigned  io_order;
           unsigned  short port;
           void     *dst;
+          unsigned  io_count;
         };
       };
     };
@@ -69,8 +71,13 @@ struct CpuMessage {
 
   CpuMessage(Type _type, CpuState *_cpu, unsigned _mtr_in) : type(_type), cpu(_cpu), mtr_in(_mtr_in), mtr_out(0), consumed(0) { if (type == TYPE_CPUID) cpuid_index = cpu->eax; }
   CpuMessage(unsigned _nr, unsigned _reg, unsigned _mask, unsigned _value) : type(TYPE_CPUID_WRITE), nr(_nr), reg(_reg), mask(_mask), value(_value), consumed(0) {}
-  CpuMessage(bool is_in, CpuState *_cpu, unsigned _io_order, unsigned _port, void *_dst, unsigned _mtr_in)
-  : type(is_in ? TYPE_IOIN : TYPE_IOOUT), cpu(_cpu), io_order(_io_order), port(_port), dst(_dst), mtr_in(_mtr_in), mtr_out(0), consumed(0) {}
+  /**
+   * An in() or out().  With a count, dst is a string of count
+   * elements.  On return, dst and count point behind the elements
+   * that were transferred.
+   */
+  CpuMessage(bool is_in, CpuState *_cpu, unsigned _io_order, unsigned _port, void *_dst, unsigned _mtr_in, unsigned _io_count = 0)
+  : type(is_in ? TYPE_IOIN : TYPE_IOOUT), cpu(_cpu), io_order(_io_order), port(_port), dst(_dst), io_count(_io_count), mtr_in(_mtr_in), mtr_out(0), consumed(0) {}
 };
 
 
@@ -84,27 +91,68 @@ struct LapicEvent {
   enum Type{
     INTA,
     RESET,
-    INIT
+    INIT,
+    TPR     ///< the TPR shadow crossed its threshold
   } type;
   unsigned value;
   LapicEvent(Type _type) : type(_type) { if (type == INTA) value = ~0u; }
 };
 
 
+/**
+ * The TPR of the local APIC, shadowed in the VCPU.  A CPU model may
+ * read and write it at phys without an MMIO transaction.  The LAPIC
+ * only needs to know about a write that moves the TPR across
+ * threshold, the priority class of the highest IRR that is not
+ * blocked by the ISR.
+ */
+struct TprShadow
+{
+  uintptr_t phys;       ///< the physical address of the TPR or ~0
+  unsigned  value;
+  unsigned  threshold;
+
+  /**
+   * Write the TPR.  Returns true if the LAPIC has to re-evaluate its
+   * interrupts.
+   */
+  bool write(unsigned _value)
+  {
+    bool crossed = (value < threshold) != (_value < threshold);
+    value = _value;
+    return crossed;
+  }
+
+  TprShadow() : phys(~0ul), value(0), threshold(0) {}
+};
+
+
 class VCpu
 {
   VCpu *_last;
+protected:
+  volatile unsigned _event;
 public:
   DBus<CpuMessage>       executor;
+  DBus<CpuMessage>       executor_bios; ///< single steps at the virtual BIOS entry points
   DBus<CpuEvent>         bus_event;
   DBus<LapicEvent>       bus_lapic;
   DBus<MessageMem>       mem;
   DBus<MessageMemRegion> memregion;
+  TprShadow              tpr;
 
   VCpu *get_last() { return _last; }
   bool is_ap()     { return _last; }
 
   bool set_cpuid(unsigned nr, unsigned reg, unsigned value, unsigned mask=~0) {  CpuMessage msg(nr, reg, ~mask, value & mask); return executor.send(msg); }
+
+  /**
+   * Is the CPU about to execute an entry point of the virtual BIOS?
+   */
+  static bool in_bios_window(CpuState *cpu)
+  {
+    return (cpu->cs.base + cpu->eip - MessageBios::BIOS_BASE) < MessageBios::MAX_VECTOR;
+  }
   enum {
     EVENT_INTR   = 1 <<  0,
     EVENT_FIXED  = 1 <<  0,
@@ -125,6 +173,17 @@ public:
     EVENT_HOST   = 1 << 20
   };
 
+  /**
+   * Does an event wait that has to be handled before the next
+   * instruction?  A pending INTR only counts if the CPU could take it.
+   */
+  bool event_pending(CpuState *cpu)
+  {
+    unsigned event = _event;
+    return event & (EVENT_MASK & ~EVENT_INTR | EVENT_DEBUG | EVENT_HOST)
+      || event & EVENT_INTR && cpu->efl & 0x200;
+  }
+
   unsigned long long inj_count;
-  VCpu (VCpu *last) : _last(last), inj_count(0) {}
+  VCpu (VCpu *last) : _last(last), _event(0), inj_count(0) {}
 };
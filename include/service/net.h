@@ -61,22 +61,15 @@ operator==(EthernetAddr const& a, EthernetAddr const& b)
 class IPChecksum {
 protected:
 
-  static inline uint32 
-  sum_simple(uint8 const *buf, size_t size, bool &odd)
+  // Sum size bytes that start at an even offset of the checksummed
+  // data. A trailing odd byte is the first byte of a 16-bit word.
+  static inline uint32
+  sum_simple(uint8 const *buf, size_t size)
   {
     // Cannot sum more because of overflow
     assert(size < 65535);
 
     uint32 astate = 0;
-
-    //Logging::printf("sum_simple %u %u\n", size, odd);
-    if (odd and (size != 0)) {
-      astate += *(buf++);
-      size--;
-      odd = false;
-      //Logging::printf("corrected initial oddness: %u %u\n", size, odd);
-    }
-
     while (size >= 2) {
       uint16 const *buf16 = reinterpret_cast<uint16 const *>(buf);
       astate += *buf16;
@@ -84,34 +77,18 @@ protected:
       size -= 2;
     }
 
-    if (size != 0) {
-      // XXX Correct?
+    if (size != 0)
       astate += *buf;
-      odd = true;
-      //Logging::printf("Odd bytes. beware...\n");
-    } else
-      odd = false;
-
-    //Logging::printf("<- %u %u\n", size, odd);
     return astate;
   }
-  
-  // Sums data until buf is 16-byte aligned. This handles odd numbers
-  // of align_steps. You should continue in odd mode, if this happens!
+
+  // The sum of data that starts at an odd offset is the byte-swapped
+  // sum of the same data taken at an even offset.
   static inline uint32
-  sum_align(uint8 const * &buf, size_t &size, unsigned &align_steps, bool &odd)
+  swap(uint32 state)
   {
-    //Logging::printf("align %u %u\n", align_steps, odd);
-    if (align_steps == 0) return 0;
-    //assert((align_steps % 2) == 0);
-    if (align_steps > size)
-      align_steps = size;
-
-    uint32 res = sum_simple(buf, align_steps, odd);
-
-    buf  += align_steps;
-    size -= align_steps;
-    return res;
+    uint16 v = fixup(state);
+    return static_cast<uint16>((v << 8) | (v >> 8));
   }
 
   static inline  __attribute__((always_inline)) uint32
@@ -135,28 +112,27 @@ protected:
   }
 
   static inline  __attribute__((always_inline)) uint32
-  sse_final(__m128i sum, __m128i z, bool odd)
+  sse_final(__m128i sum)
   {
-    /* Add top to bottom 64-bit word */
-    sum = _mm_add_epi64(sum, _mm_srli_si128(sum, 8));
-    
-    /* Add low two 32-bit words */
-#ifdef __SSSE3__
-    sum = _mm_hadd_epi32(sum, z);
-#else  // No SSSE3
-#warning SSSE3 not available
-    sum = _mm_add_epi32(sum, _mm_srli_si128(sum, 4));
-#endif
-    if (odd) {
-      // XXX
-      Logging::printf("sse_final ODD %08x -> %04x -> %04x\n", _mm_cvtsi128_si32(sum),
-                      fixup(_mm_cvtsi128_si32(sum)), Endian::hton16(fixup(_mm_cvtsi128_si32(sum))));
-      return Endian::hton16(fixup(_mm_cvtsi128_si32(sum)));
-    } else
-      return _mm_cvtsi128_si32(sum);
+    // Add both 64-bit lanes and fold the carries back in.
+    uint64 lanes[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), sum);
+    uint64 v = lanes[0] + lanes[1];
+    v = (v & 0xFFFFFFFFU) + (v >> 32);
+    v = (v & 0xFFFFFFFFU) + (v >> 32);
+    return v;
   }
 #endif
 
+  // Add the sum of a piece to the state. The piece was summed as if
+  // it started at an even offset.
+  static inline void
+  add_piece(uint32 piece, size_t size, uint32 &state, bool &odd)
+  {
+    state = addoc(state, odd ? swap(piece) : piece);
+    odd  ^= size & 1;
+  }
+
 public:
 
   // Compute the final 16-bit checksum from our internal checksum
@@ -172,25 +148,23 @@ public:
   static void
   sum(uint8 const *buf, size_t size, uint32 &state, bool &odd)
   {
-    //Logging::printf("sum(%p, %u, %08x, %u)\n", buf, size, state, odd);
-    //hexdump(buf, size);
-    uint8 const *buf_end = buf + size;
-    unsigned cstate      = state;
+    size_t total = size;
 
     // Step 1: Align buffer to 16 byte (for SSE)
-    unsigned align_steps = 0xF & (0x10 - (reinterpret_cast<mword>(buf) & 0xF));
-    cstate = addoc(cstate, sum_align(buf, size, align_steps, odd));
-    //Logging::printf("sum %u align steps\n", align_steps);
+    size_t align_steps = 0xF & (0x10 - (reinterpret_cast<mword>(buf) & 0xF));
+    if (align_steps > size) align_steps = size;
+    uint32 head = sum_simple(buf, align_steps);
+    buf  += align_steps;
+    size -= align_steps;
 
     // Step 2: Checksum in large, aligned chunks
+    uint32 rest = 0;
 #ifdef __SSE2__
     {
       const __m128i z = _mm_setzero_si128();
       __m128i     sum = _mm_setzero_si128();
 
-      while (size > 32) {
-        assert((buf + 32) <= buf_end);
-
+      while (size >= 32) {
         __m128i v1 = _mm_load_si128(reinterpret_cast<__m128i const *>(buf));
         __m128i v2 = _mm_load_si128(reinterpret_cast<__m128i const *>(buf) + 1);
 
@@ -200,16 +174,14 @@ public:
         buf  += 32;
       }
       
-      cstate = addoc(cstate, sse_final(sum, z, odd));
+      rest = sse_final(sum);
     }
 #endif
 
     // Step 3: Checksum unaligned rest
-    uint32 rstate = sum_simple(buf, size, odd);
-    cstate = addoc(cstate, rstate);
+    rest = addoc(rest, sum_simple(buf, size));
 
-    state = cstate;
-    //Logging::printf("sum() -> %08x %04x %u\n", state, fixup(state), odd);
+    add_piece(addoc(head, (align_steps & 1) ? swap(rest) : rest), total, state, odd);
   }
   
   /// Compute an IP checksum.
@@ -257,33 +229,25 @@ public:
   static void
   move(uint8 * dst, uint8 const * src, size_t size, uint32 &state, bool &odd)
   {
-    // Logging::printf("move(%p, %p, %u, %08x, %u)\n", dst, src, size, state, odd);
-    // hexdump(src, size);
+    size_t total = size;
 
     // Step 1: Align dst
-    mword dsti = reinterpret_cast<mword>(dst);
-
-    {
-      unsigned align_steps = 0xF & (0x10 - (dsti & 0xF));
-      //Logging::printf("move %u align steps odd %u\n", align_steps, odd);
-
-      state = addoc(state, sum_align(src, size, align_steps, odd));
-      memcpy(dst, src - align_steps, align_steps);
-
-      // src is already set by sum_align
-      dst += align_steps;
-
-      //assert(memcmp(dst-align_steps, src-align_steps, align_steps) == 0);
-      //Logging::printf("move aligned %u\n", odd);
-    }
+    size_t align_steps = 0xF & (0x10 - (reinterpret_cast<mword>(dst) & 0xF));
+    if (align_steps > size) align_steps = size;
+    uint32 head = sum_simple(src, align_steps);
+    memcpy(dst, src, align_steps);
+    src  += align_steps;
+    dst  += align_steps;
+    size -= align_steps;
 
+    uint32 rest = 0;
 #ifdef __SSE2__
     // Step 2: The Heavy Lifting
     {
       const __m128i z = _mm_setzero_si128();
       __m128i     sum = _mm_setzero_si128();
     
-      while (size > 32) {
+      while (size >= 32) {
         __m128i v1 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(src));
         __m128i v2 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(src) + 1);
       
@@ -297,21 +261,17 @@ public:
         dst  += 32;
       }
 
-      state = addoc(state, sse_final(sum, z, odd));
+      rest = sse_final(sum);
     }
 #else
 #warning IPChecksum::move built without SSE. This is terribly slow.
 #endif
 
     // Step 3: The Trail
-    //if (size == 0) return;
-
-    state = addoc(state, sum_simple(src, size, odd));
+    rest = addoc(rest, sum_simple(src, size));
     memcpy(dst, src, size);
 
-    //assert(memcmp(dst, src, size) == 0);
-
-    //Logging::printf("move() -> %08x %04x %u\n", state, fixup(state), odd);
+    add_piece(addoc(head, (align_steps & 1) ? swap(rest) : rest), total, state, odd);
   }
 
 };
@@ -371,4 +331,219 @@ public:
   IPChecksumState() : _state(0), _odd(false) {}
 };
 
+
+/**
+ * The offloads requested for a packet. Offsets are relative to the
+ * start of the Ethernet frame.
+ */
+struct NetOffload
+{
+  enum {
+    CSUM_IP4 = 1U << 0,         ///< fill in the IPv4 header checksum
+    CSUM_L4  = 1U << 1,         ///< fill in the TCP/UDP checksum
+    SEGMENT  = 1U << 2,         ///< split the payload into mss sized segments
+  };
+
+  enum {
+    L4_NONE,
+    L4_TCP,
+    L4_UDP,
+  };
+
+  unsigned flags;
+  unsigned l4;
+  bool     ipv6;
+  unsigned maclen;
+  unsigned iplen;               ///< includes IPv6 extension headers
+  unsigned l4len;               ///< zero to take it from the packet
+  unsigned mss;
+
+  NetOffload() : flags(), l4(), ipv6(), maclen(), iplen(), l4len(), mss() {}
+};
+
+/**
+ * A piece of a scattered packet.
+ */
+struct NetFragment
+{
+  const uint8 *data;
+  size_t       len;
+};
+
+/**
+ * Applies segmentation and checksum offloads in software.
+ *
+ * Each call to next() writes one complete segment into the given
+ * buffer. Its payload is gathered from the fragments and checksummed
+ * in the same pass. TCP segments get consecutive sequence numbers and
+ * FIN/PSH only on the last segment. UDP is split into datagrams of
+ * mss bytes each.
+ */
+class NetSegmenter
+{
+public:
+  enum { MAX_HEADER = 256 };
+
+private:
+  NetOffload         _o;
+  const NetFragment *_frag;
+  unsigned           _nfrags;
+  size_t             _pos;      // offset into the current fragment
+  size_t             _left;     // payload bytes not yet sent
+  unsigned           _hlen;
+  bool               _started;
+  uint8              _header[MAX_HEADER];
+
+  // Copy len bytes from the fragments and update the checksum, if given.
+  void gather(uint8 *dst, size_t len, IPChecksumState *cs)
+  {
+    while (len && _nfrags) {
+      if (_pos == _frag->len) { _frag++; _nfrags--; _pos = 0; continue; }
+      size_t n = _frag->len - _pos;
+      if (n > len) n = len;
+      if (cs) cs->move(dst, _frag->data + _pos, n); else memcpy(dst, _frag->data + _pos, n);
+      dst  += n;
+      _pos += n;
+      len  -= n;
+    }
+  }
+
+  void add16(uint8 *p, unsigned value)
+  {
+    uint16 &v = *reinterpret_cast<uint16 *>(p);
+    v = Endian::hton16(Endian::ntoh16(v) + value);
+  }
+
+  void add32(uint8 *p, unsigned value)
+  {
+    uint32 &v = *reinterpret_cast<uint32 *>(p);
+    v = Endian::hton32(Endian::ntoh32(v) + value);
+  }
+
+  void l4_checksum(uint8 *buf, unsigned len, unsigned payload)
+  {
+    uint8 *l4   = buf + _o.maclen + _o.iplen;
+    uint8 *csum = l4 + (_o.l4 == NetOffload::L4_UDP ? 6 : 16);
+    uint8 proto = _o.l4 == NetOffload::L4_UDP ? 17 : 6;
+    csum[0] = csum[1] = 0;
+
+    IPChecksumState cs;
+    if (_o.ipv6) {
+      const uint32 pseudo[2] = { Endian::hton32(len - _o.maclen - _o.iplen), Endian::hton32(proto) };
+      cs.update(buf + _o.maclen + 8, 32);
+      cs.update(reinterpret_cast<const uint8 *>(pseudo), sizeof(pseudo));
+    } else {
+      const uint16 pseudo[2] = { static_cast<uint16>(proto << 8), Endian::hton16(len - _o.maclen - _o.iplen) };
+      cs.update(buf + _o.maclen + 12, 8);
+      cs.update(reinterpret_cast<const uint8 *>(pseudo), sizeof(pseudo));
+    }
+    cs.update(l4, _o.l4len);
+    gather(buf + _hlen, payload, &cs);
+
+    uint16 sum = cs.value();
+    if (_o.l4 == NetOffload::L4_UDP && !sum) sum = 0xFFFF;
+    csum[0] = sum;
+    csum[1] = sum >> 8;
+  }
+
+public:
+
+  /**
+   * Start on a new packet. Returns false if the offload does not fit
+   * the packet.
+   */
+  bool init(const NetOffload &o, const NetFragment *frag, unsigned nfrags)
+  {
+    size_t total = 0;
+    for (unsigned i = 0; i < nfrags; i++) total += frag[i].len;
+
+    _o = o;
+    _frag = frag;
+    _nfrags = nfrags;
+    _pos = 0;
+    _started = false;
+    gather(_header, total < size_t(MAX_HEADER) ? total : size_t(MAX_HEADER), 0);
+    _frag = frag;
+    _nfrags = nfrags;
+    _pos = 0;
+
+    if (_o.l4 == NetOffload::L4_NONE)
+      _o.flags &= ~(NetOffload::CSUM_L4 | NetOffload::SEGMENT);
+    // the original checksum does not match any segment
+    if (_o.flags & NetOffload::SEGMENT) _o.flags |= NetOffload::CSUM_L4;
+    if (_o.ipv6) _o.flags &= ~NetOffload::CSUM_IP4;
+
+    unsigned l3 = _o.maclen + _o.iplen;
+    if (!_o.l4len && _o.l4 == NetOffload::L4_TCP && l3 + 13 <= total && l3 + 13 <= MAX_HEADER)
+      _o.l4len = (_header[l3 + 12] >> 4) * 4;
+    if (!_o.l4len && _o.l4 == NetOffload::L4_UDP)
+      _o.l4len = 8;
+
+    _hlen = l3 + _o.l4len;
+    if (_hlen > total || _hlen > MAX_HEADER || (_o.flags & NetOffload::SEGMENT && !_o.mss)
+        || (_o.l4 != NetOffload::L4_NONE && _o.l4len < (_o.l4 == NetOffload::L4_UDP ? 8U : 20U))) {
+      _left = 0;
+      _started = true;
+      return false;
+    }
+
+    // skip the header, we send it from our copy
+    gather(_header, _hlen, 0);
+    _left = total - _hlen;
+    return true;
+  }
+
+  /**
+   * Write the next segment into buf. Returns its length or zero if
+   * there is none left.
+   */
+  size_t next(uint8 *buf, size_t size)
+  {
+    if (_started && !_left) return 0;
+    _started = true;
+
+    size_t payload = _left;
+    if (_o.flags & NetOffload::SEGMENT && payload > _o.mss) payload = _o.mss;
+    size_t len = _hlen + payload;
+    if (len > size) {
+      Logging::printf("GSO: %zu byte segment does not fit into %zu bytes.\n", len, size);
+      _left = 0;
+      return 0;
+    }
+    _left -= payload;
+
+    memcpy(buf, _header, _hlen);
+    uint8 *ip = buf + _o.maclen;
+    uint8 *l4 = ip + _o.iplen;
+
+    if (_o.flags & NetOffload::SEGMENT) {
+      if (_o.ipv6)
+        *reinterpret_cast<uint16 *>(ip + 4) = Endian::hton16(len - _o.maclen - 40);
+      else
+        *reinterpret_cast<uint16 *>(ip + 2) = Endian::hton16(len - _o.maclen);
+
+      if (_o.l4 == NetOffload::L4_TCP) {
+        if (_left) l4[13] &= ~9;  // FIN and PSH go with the last segment
+        add32(_header + _o.maclen + _o.iplen + 4, payload);
+      } else
+        *reinterpret_cast<uint16 *>(l4 + 4) = Endian::hton16(len - _o.maclen - _o.iplen);
+
+      if (!_o.ipv6) add16(_header + _o.maclen + 4, 1);
+    }
+
+    if (_o.flags & NetOffload::CSUM_IP4) {
+      ip[10] = ip[11] = 0;
+      *reinterpret_cast<uint16 *>(ip + 10) = IPChecksum::ipsum(buf, _o.maclen, _o.iplen);
+    }
+
+    if (_o.flags & NetOffload::CSUM_L4)
+      l4_checksum(buf, len, payload);
+    else
+      gather(buf + _hlen, payload, 0);
+    return len;
+  }
+
+  NetSegmenter() : _o(), _frag(), _nfrags(), _pos(), _left(), _hlen(), _started(true) {}
+};
+
 // EOF
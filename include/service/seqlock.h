@@ -0,0 +1,57 @@
+/** @file
+ * Sequence lock.
+ *
+ * Economic rights: Technische Universitaet Dresden (Germany)
+ *
+ * This file is part of Vancouver.
+ *
+ * Vancouver is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Vancouver is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+#pragma once
+
+#include "service/cpu.h"
+
+/**
+ * Protects a snapshot that is written under a lock and read without
+ * one.  Readers retry until they got a copy that no writer touched.
+ */
+class SeqLock
+{
+  unsigned _seq;
+
+public:
+  /**
+   * Publish a new snapshot.  Writers have to be serialized.
+   */
+  template <typename T>
+  void write(T &snapshot, const T &value)
+  {
+    __atomic_store_n(&_seq, _seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    snapshot = value;
+    __atomic_store_n(&_seq, _seq + 1, __ATOMIC_RELEASE);
+  }
+
+  /**
+   * Get a consistent copy of the snapshot.
+   */
+  template <typename T>
+  void read(T &copy, const T &snapshot)
+  {
+    unsigned seq;
+    do {
+      while ((seq = __atomic_load_n(&_seq, __ATOMIC_ACQUIRE)) & 1)  Cpu::pause();
+      copy = snapshot;
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&_seq, __ATOMIC_RELAXED) != seq);
+  }
+
+  SeqLock() : _seq(0) {}
+};
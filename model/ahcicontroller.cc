@@ -25,7 +25,7 @@
 class ParentIrqProvider
 {
  public:
-  virtual void trigger_irq (void * child) = 0;
+  virtual void trigger_irq (void * child, bool completion) = 0;
 };
 
 /**
@@ -64,6 +64,7 @@ public:
   void receive_fis(size_t fislen, unsigned *fis)
   {
     size_t copy_offset;
+    bool completion = false;
 
     // fis receiving enabled?
     // XXX bug in 2.6.27?
@@ -95,6 +96,8 @@ public:
 	  _inprogress &= ~mask;
 	  PxCI &= ~mask;
 	  PxSACT &= ~mask;
+	  // a task-file error is not a plain completion
+	  completion = ~fis[0] & 0x10000;
 	}
 	else
 	  Logging::printf("not finished %x,%x inprogress %x\n", fis[0], fis[4], _inprogress);
@@ -115,7 +118,7 @@ public:
 
     // copy to user
     if (PxCMD & 0x10)  copy_out(PxFB + copy_offset, fis, fislen * 4);
-    if (fis[0] & 0x4000) _parent->trigger_irq(this);
+    if (fis[0] & 0x4000) _parent->trigger_irq(this, completion);
   };
 
 
@@ -264,7 +267,7 @@ VMM_REGSET(PCI,
 
 
 VMM_REGSET(AhciController,
-       VMM_REG_RW(REG_CAP,   0x0, 0x40149f00 | (AhciController::MAX_PORTS - 1), 0,)
+       VMM_REG_RW(REG_CAP,   0x0, 0x40149f80 | (AhciController::MAX_PORTS - 1), 0,)
        VMM_REG_WR(REG_GHC,   0x4, 0x80000000, 0x3, 0x1, 0,
 	      // reset HBA?
 	      if (REG_GHC & 1) {
@@ -272,10 +275,18 @@ VMM_REGSET(AhciController,
 		// set all registers to default values
 		REG_IS  = REG_IS_reset;
 		REG_GHC = REG_GHC_reset;
+		REG_CCC_CTL   = REG_CCC_CTL_reset;
+		REG_CCC_PORTS = REG_CCC_PORTS_reset;
+		ccc_reset();
 	      })
        VMM_REG_WR(REG_IS,    0x8, 0, 0xffffffff, 0x00000000, 0xffffffff, )
        VMM_REG_RW(REG_PI,    0xc, 1, 0,)
        VMM_REG_RO(REG_VS,   0x10, 0x00010200)
+       VMM_REG_WR(REG_CCC_CTL, 0x14, 0x00010100, 0xffffff01, 0, 0,
+	      // the timeout and the threshold are fixed while enabled
+	      if (oldvalue & 1)  REG_CCC_CTL = (oldvalue & ~1) | (REG_CCC_CTL & 1);
+	      if (oldvalue & 1 && ~REG_CCC_CTL & 1) ccc_flush(); else ccc_reset();)
+       VMM_REG_RW(REG_CCC_PORTS, 0x18, 0, 0xffffffff, REG_CCC_PORTS &= REG_PI; )
        VMM_REG_RO(REG_CAP2, 0x24, 0x0));
 
 #endif
@@ -287,7 +298,7 @@ VMM_REGSET(AhciController,
  * An AhciController on a PCI card.
  *
  * State: unstable
- * Features: PCI cfg space, AHCI register set, MSI delivery
+ * Features: PCI cfg space, AHCI register set, MSI delivery, command completion coalescing
  */
 class AhciController : public ParentIrqProvider,
 		       public StaticReceiver<AhciController>
@@ -295,11 +306,17 @@ class AhciController : public ParentIrqProvider,
   enum {
     MAX_PORTS = 32,
   };
-  DBus<MessageIrqLines> &_bus_irqlines;
+  DBusIrqLines &_bus_irqlines;
   DBus<MessageMem> 	&_bus_mem;
+  DBus<MessageTimer>    &_bus_timer;
+  Clock        *_clock;
   unsigned char _irq;
   AhciPort _ports[MAX_PORTS];
   unsigned _bdf;
+  unsigned _timer;
+  unsigned _ccc_count;   ///< coalesced completions since the last CCC interrupt
+  unsigned _ccc_pending; ///< ports with coalesced completions
+  timevalue _ccc_deadline;
 #define AHCI_CONTROLLER
 #define  VMM_REGBASE "../model/ahcicontroller.cc"
 #include "model/reg.h"
@@ -311,10 +328,12 @@ class AhciController : public ParentIrqProvider,
   }
 
 
- public:
-
-  void trigger_irq (void * child) {
-    unsigned index = reinterpret_cast<AhciPort *>(child) - _ports;
+  /**
+   * Set the interrupt status of the given port and raise an
+   * interrupt if it was not already pending.
+   */
+  void raise_irq(unsigned index)
+  {
     if (~REG_IS & (1 << index))
       {
 	REG_IS |= 1 << index;
@@ -331,28 +350,124 @@ class AhciController : public ParentIrqProvider,
 	    }
 	  }
       }
+  }
+
+
+  /**
+   * The interrupt vector of CCC is the first unimplemented port.
+   */
+  unsigned ccc_vector()
+  {
+    unsigned i = 0;
+    while (i < MAX_PORTS - 1 && REG_PI & (1 << i)) i++;
+    return i;
+  }
+
+
+  void ccc_reset()
+  {
+    REG_CCC_CTL = (REG_CCC_CTL & ~0xf8) | (ccc_vector() << 3);
+    _ccc_count = 0;
+    _ccc_pending = 0;
+    _ccc_deadline = ~0ull;
+  }
+
+
+  /**
+   * CCC was disabled: raise the port interrupts of the completions
+   * that were still coalesced.
+   */
+  void ccc_flush()
+  {
+    for (unsigned i = 0; i < MAX_PORTS; i++)
+      if (_ccc_pending & (1 << i)) raise_irq(i);
+    ccc_reset();
+  }
+
+
+  /**
+   * Raise the coalesced interrupt.
+   */
+  void ccc_fire()
+  {
+    COUNTER_INC("ahci ccc");
+    _ccc_count = 0;
+    _ccc_pending = 0;
+    // a timeout that is still programmed is ignored
+    _ccc_deadline = ~0ull;
+    raise_irq((REG_CCC_CTL >> 3) & 0x1f);
+  }
+
+
+ public:
+
+  /**
+   * A port signals an interrupt.  Command completions of ports in
+   * CCC_PORTS are counted instead and raise a single interrupt when
+   * the threshold is reached or the timeout expires.  Errors are
+   * never delayed.
+   */
+  void trigger_irq (void * child, bool completion) {
+    unsigned index = reinterpret_cast<AhciPort *>(child) - _ports;
+    if (~REG_CCC_CTL & 1 || ~REG_CCC_PORTS & (1 << index) || !completion)
+      return raise_irq(index);
+
+    unsigned threshold = (REG_CCC_CTL >> 8) & 0xff;
+    unsigned timeout   = REG_CCC_CTL >> 16;
+    _ccc_count++;
+    _ccc_pending |= 1 << index;
+    if ((threshold && _ccc_count >= threshold) || !timeout)
+      return ccc_fire();
+
+    // the first completion starts the timeout
+    if (_ccc_count == 1)
+      {
+	_ccc_deadline = _clock->abstime(timeout, 1000);
+	MessageTimer msg(_timer, _ccc_deadline);
+	_bus_timer.send(msg);
+      }
   };
 
 
-  bool receive(MessageMem &msg)
+  bool receive(MessageTimeout &msg)
   {
-    uintptr_t addr = msg.phys;
-    if (!match_bar(addr) || !(PCI_CMD_STS & 0x2))
-      return false;
+    if (msg.nr != _timer) return false;
+    if (~REG_CCC_CTL & 1 || !_ccc_count) return true;
+
+    // the timeout of an earlier round
+    if (_clock->time() < _ccc_deadline)
+      {
+	MessageTimer msg1(_timer, _ccc_deadline);
+	_bus_timer.send(msg1);
+	return true;
+      }
+    ccc_fire();
+    return true;
+  }
 
-    assert(!(addr & 0x3));
 
-    bool res;
-    unsigned uvalue = 0;
-    if (addr < 0x100)
-      res = msg.read ? AhciController_read(addr, uvalue) : AhciController_write(addr, *msg.ptr);
-    else if (addr < 0x100+MAX_PORTS*0x80)
-      res = msg.read ? _ports[(addr - 0x100) / 0x80].AhciPort_read(addr & 0x7f, uvalue) : _ports[(addr - 0x100) / 0x80].AhciPort_write(addr & 0x7f, *msg.ptr);
-    else
+  bool receive(MessageMem &msg)
+  {
+    uintptr_t base = msg.phys;
+    if (!match_bar(base) || !(PCI_CMD_STS & 0x2))
       return false;
 
-    if (res && msg.read)  *msg.ptr = uvalue;
-    else if (!res)  Logging::printf("%s(%zx) %s failed\n", __PRETTY_FUNCTION__, size_t(addr), msg.read ? "read" : "write");
+    assert(!(base & 0x3));
+    if (base + msg.len > 0x100+MAX_PORTS*0x80) return false;
+
+    // wide accesses, e.g. to the 64-bit CLB and FB registers, are split here
+    for (unsigned i = 0; i < msg.len / 4; i++) {
+      uintptr_t addr = base + i*4;
+      bool res;
+      unsigned uvalue = 0;
+      if (addr < 0x100)
+	res = msg.read ? AhciController_read(addr, uvalue) : AhciController_write(addr, msg.ptr[i]);
+      else
+	res = msg.read ? _ports[(addr - 0x100) / 0x80].AhciPort_read(addr & 0x7f, uvalue) : _ports[(addr - 0x100) / 0x80].AhciPort_write(addr & 0x7f, msg.ptr[i]);
+
+      if (res && msg.read)  msg.ptr[i] = uvalue;
+      else if (!res)  Logging::printf("%s(%zx) %s failed\n", __PRETTY_FUNCTION__, size_t(addr), msg.read ? "read" : "write");
+    }
     return true;
   }
 
@@ -372,16 +487,23 @@ class AhciController : public ParentIrqProvider,
     unsigned value = REG_PI;
     for (;value; value >>= 1) { count += value & 1; }
     REG_CAP = (REG_CAP & ~0x1f) | (count - 1);
+    if (~REG_CCC_CTL & 1) ccc_reset();
     return true;
   }
 
   bool receive(MessagePciConfig &msg) { return PciHelper::receive(msg, this, _bdf); }
   AhciController(Motherboard &mb, unsigned char irq, unsigned bdf)
-    : _bus_irqlines(mb.bus_irqlines), _bus_mem(mb.bus_mem), _irq(irq), _bdf(bdf)
+    : _bus_irqlines(mb.bus_irqlines), _bus_mem(mb.bus_mem), _bus_timer(mb.bus_timer), _clock(mb.clock()), _irq(irq), _bdf(bdf)
   {
     for (unsigned i=0; i < MAX_PORTS; i++) _ports[i].set_parent(this, &mb.bus_memregion, &mb.bus_mem);
     PCI_reset();
     AhciController_reset();
+    ccc_reset();
+
+    MessageTimer msg0(this, receive_static<MessageTimeout>);
+    if (!_bus_timer.send(msg0))
+      Logging::panic("%s can't get a timer", __PRETTY_FUNCTION__);
+    _timer = msg0.nr;
   };
 };
 
@@ -400,6 +522,7 @@ PARAM_HANDLER(ahci,
 
   // register for AhciSetDrive messages
   mb.bus_ahcicontroller.add(dev, AhciController::receive_static<MessageAhciSetDrive>);
+  mb.bus_timeout.add(dev, AhciController::receive_static<MessageTimeout>);
 
   // set default state, this is normally done by the BIOS
   // set MMIO region and IRQ
@@ -43,12 +43,12 @@ class DirectMemDevice : public StaticReceiver<DirectMemDevice>
 
   bool  receive(MessageMem &msg)
   {
-    unsigned *ptr;
-    if (in_range(msg.phys, _phys, _size))
-      ptr = reinterpret_cast<unsigned *>(_ptr + msg.phys - _phys);
+    char *ptr;
+    if (in_range(msg.phys, _phys, _size - msg.len + 1))
+      ptr = _ptr + msg.phys - _phys;
     else return false;
 
-    if (msg.read) *msg.ptr = *ptr; else *ptr = *msg.ptr;
+    if (msg.read) memcpy(msg.ptr, ptr, msg.len); else memcpy(ptr, msg.ptr, msg.len);
     return true;
   }
 
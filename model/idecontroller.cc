@@ -43,7 +43,7 @@ public:
   };
 private:
   DBus<MessageDisk> &_bus_disk;
-  DBus<MessageIrqLines>  &_bus_irqlines;
+  DBusIrqLines  &_bus_irqlines;
   unsigned char      _irq;
   unsigned           _bdf;
   unsigned           _disknr;
@@ -132,6 +132,25 @@ private:
     identify[0xff] -= checksum << 8;
   }
 
+  /**
+   * Move a string of count elements between ptr and the sector
+   * buffer.  The transfer stops at the end of the sector.
+   */
+  bool string_io(bool read, unsigned order, unsigned &count, void *&ptr)
+  {
+    unsigned len = 512 - _bufferoffset;
+    if (len > (count << order)) len = count << order;
+    len &= ~((1u << order) - 1);
+    if (!len) return false;
+
+    char *p = reinterpret_cast<char *>(ptr);
+    if (read) memcpy(p, _buffer + _bufferoffset, len); else memcpy(_buffer + _bufferoffset, p, len);
+    _bufferoffset += len;
+    count -= len >> order;
+    ptr = p + len;
+    return true;
+  }
+
   void do_read(bool initial, unsigned long long sector) {
     if (!initial and !_count)  {
       _status &= ~0x88; // no data anymore
@@ -227,13 +246,18 @@ private:
   {
     if (!((msg.port ^ PCI_BAR0) & PCI_BAR0_mask)) {
       unsigned port = msg.port & ~PCI_BAR0_mask;
-      if (port and msg.type != MessageIOIn::TYPE_INB) return false;
+      if (port and (msg.type != MessageIOIn::TYPE_INB or msg.count)) return false;
       switch (port) {
       case 0:
 	if (_bufferoffset >= 512) return false;
-	Cpu::move(&msg.value, _buffer + _bufferoffset, msg.type);
-	if (!_bufferoffset) { LOG("data[%d] = %04x\n", _bufferoffset, msg.value); }
-	_bufferoffset += 1 << msg.type;
+	if (msg.count) {
+	  if (!string_io(true, msg.type, msg.count, msg.ptr)) return false;
+	}
+	else {
+	  Cpu::move(&msg.value, _buffer + _bufferoffset, msg.type);
+	  if (!_bufferoffset) { LOG("data[%d] = %04x\n", _bufferoffset, msg.value); }
+	  _bufferoffset += 1 << msg.type;
+	}
 	// reissue the command if work left
 	if (_bufferoffset >= 512)  issue_command(false);
 	break;
@@ -254,7 +278,7 @@ private:
       return true;
     }
     // alternate status register
-    if (!((msg.port ^ PCI_BAR1) & PCI_BAR1_mask) and msg.type == MessageIOIn::TYPE_INB and ((msg.port & ~PCI_BAR1_mask) == 2)) {
+    if (!((msg.port ^ PCI_BAR1) & PCI_BAR1_mask) and msg.type == MessageIOIn::TYPE_INB and !msg.count and ((msg.port & ~PCI_BAR1_mask) == 2)) {
       LOG("alternate status %x\n", _status);
       msg.value = _status;
       return true;
@@ -267,11 +291,12 @@ private:
   {
     if (!((msg.port ^ PCI_BAR0) & PCI_BAR0_mask)) {
       unsigned port = msg.port & ~PCI_BAR0_mask;
-      if (port and msg.type != MessageIOOut::TYPE_OUTB) return false;
+      if (port and (msg.type != MessageIOOut::TYPE_OUTB or msg.count)) return false;
       LOG("out<%d>[%d] = %x\n", msg.type, port, msg.value);
       switch (port) {
       case 0:
 	if (_bufferoffset >= 512) return false;
+	if (msg.count) return string_io(false, msg.type, msg.count, msg.ptr);
 	Cpu::move(_buffer+_bufferoffset, &msg.value, msg.type);
 	_bufferoffset += 1 << msg.type;
 	return true;
@@ -289,7 +314,7 @@ private:
 	return true;
       }
     }
-    if (!((msg.port ^ PCI_BAR1) & PCI_BAR1_mask) and msg.type == MessageIOOut::TYPE_OUTB and ((msg.port & ~PCI_BAR1_mask) == 2)) {
+    if (!((msg.port ^ PCI_BAR1) & PCI_BAR1_mask) and msg.type == MessageIOOut::TYPE_OUTB and !msg.count and ((msg.port & ~PCI_BAR1_mask) == 2)) {
       // toggle reset?
       if (_control & 4 && ~msg.value & 4) reset_device();
       _control = msg.value;
@@ -303,7 +328,7 @@ private:
   bool receive(MessagePciConfig &msg) { return PciHelper::receive(msg, this, _bdf); }
 
 
-  IdeController(DBus<MessageDisk> &bus_disk, DBus<MessageIrqLines> &bus_irqlines,
+  IdeController(DBus<MessageDisk> &bus_disk, DBusIrqLines &bus_irqlines,
 		unsigned char irq, unsigned bdf, unsigned disknr, DiskParameter params, char *buffer, unsigned long baddr)
     : _bus_disk(bus_disk), _bus_irqlines(bus_irqlines),
       _irq(irq), _bdf(bdf), _disknr(disknr), _params(params), _buffer(buffer), _baddr(baddr), _bufferoffset(0)
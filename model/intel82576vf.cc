@@ -40,6 +40,9 @@ using namespace Endian;
 //     check every n µs for queued packets. n is configured using
 //     the txpoll_us parameter (see the comment at the bottom of
 //     this file).
+//  - adaptive mode:
+//     trap until the guest rings the TX doorbell often, then switch
+//     to polled mode with an interval that follows the load.
 
 // TODO
 // - handle BAR remapping
@@ -57,6 +60,7 @@ class Model82576vf : public StaticReceiver<Model82576vf>
 {
   EthernetAddr           _mac;
   DBus<MessageNetwork>  &_net;
+  DBus<MessageHostOp>   &_bus_hostop;
 #include "model/simplemem.h"
   Clock                 *_clock;
   DBus<MessageTimer>    &_timer;
@@ -74,6 +78,26 @@ class Model82576vf : public StaticReceiver<Model82576vf>
   // TX queue polling interval in µs.
   unsigned _txpoll_us;
 
+  // Adaptive TX polling. TDT writes are trapped until more than
+  // TXADAPT_RATE of them arrive within TXADAPT_WINDOW µs. Then the TX
+  // registers are mapped and polled. The interval is halved when a
+  // poll finds a batch of descriptors and doubled when it finds none.
+  // After TXPOLL_IDLE empty polls in a row, the mapping is revoked and
+  // the timer stopped.
+  enum {
+    TXADAPT_RATE   = 16,
+    TXADAPT_WINDOW = 1000,
+    TXPOLL_MIN_US  = 10,
+    TXPOLL_MAX_US  = 1000,
+    TXPOLL_BATCH   = 8,
+    TXPOLL_IDLE    = 16,
+  };
+  bool      _txadaptive;
+  bool      _txpolling;
+  timevalue _txwindow;
+  unsigned  _txdoorbells;
+  unsigned  _txidle;
+
   // Map RX registers?
   bool _map_rx;
   unsigned _bdf;
@@ -126,6 +150,15 @@ class Model82576vf : public StaticReceiver<Model82576vf>
     uint8 packet_buf[64 * 1024];
     unsigned packet_cur;
 
+    // Offloaded packets are sent from here, one segment at a time.
+    uint8 segment_buf[16 * 1024];
+
+    bool owns(const uint8 *buffer) const
+    {
+      return (buffer >= packet_buf  && buffer < packet_buf  + sizeof(packet_buf)) ||
+	     (buffer >= segment_buf && buffer < segment_buf + sizeof(segment_buf));
+    }
+
     void reset()
     {
       memset(const_cast<uint32 *>(regs), 0, 0x100);
@@ -158,140 +191,59 @@ class Model82576vf : public StaticReceiver<Model82576vf>
       ctx[desc.idx()] = desc;
     }
 
-    void apply_segmentation(uint8 *packet, uint32 packet_len,
-			    const tx_desc &desc, bool tse)
-    {
-      uint32 payload_len = desc.paylen();
-
-      if (!tse) {
-	// Skip segmentation if it is not requested.
-	if (payload_len != packet_len) {
-	  Logging::printf("XXX Got %x bytes, but payload size is %x. Huh? Ignoring packet.\n", packet_len, payload_len);
-	  return;
-	}
-	apply_offload(packet, payload_len, desc);
-        MessageNetwork m(packet, packet_len, 0);
-	parent->_net.send(m);
-      } else {
-	// TCP segmentation is a bit weird, because the payload length
-	// in the TX descriptor does not include the prototype header.
-
-	uint8  cc     = desc.idx();
-	const tx_desc &cur_ctx = ctx[cc];
-	uint16 tucmd  = cur_ctx.tucmd();
-        uint8  l4t    = (tucmd >> 2) & 3;
-	bool   ipv6   = ((tucmd & 2) == 0);
-	//uint8  l4len  = (cur_ctx.raw[1]>>40) & 0xFF;
-	uint16 mss    = (cur_ctx.raw[1]>>48) & 0xFFFF;
-	uint16 iplen  =  cur_ctx.raw[0];
-	uint8  maclen = (iplen >> 9) & 0xFF;
-	iplen &= 0x1FF;
-	uint32 header_len = packet_len - payload_len;
-	uint32 data_left = payload_len;
-	uint32 data_sent = 0;
-
-	if (l4t == tx_desc::L4T_SCTP) {
-	  Logging::printf("XXX SCTP segmentation?\n");
-	  return;
-	}
-
-	if (l4t == tx_desc::L4T_UDP) {
-	  Logging::printf("XXX UDP segmentation not implemented.\n");
-	  return;
-	}
-
-	uint16 &packet_ip4_id  = *reinterpret_cast<uint16 *>(packet + maclen + 4);
-	uint16 &packet_ip_len  = *reinterpret_cast<uint16 *>(packet + maclen + (ipv6 ? 4 : 2));
-	uint32 &packet_tcp_seq = *reinterpret_cast<uint32 *>(packet + maclen + iplen + 4);
-	uint8  &packet_tcp_flg = packet[maclen + iplen + 13];
-	uint8  tcp_orig_flg    = packet_tcp_flg;
-
-	unsigned i = 0;
-	while (data_left > 0) {
-	  uint16 chunk_size = (data_left > mss) ? mss : data_left;
-	  data_left -= chunk_size;
-	  
-	  packet_ip_len = hton16(chunk_size + header_len - maclen);
-
-	  if (l4t == tx_desc::L4T_TCP)
-	    packet_tcp_flg = tcp_orig_flg &
-	      ((data_left == 0) ? /* last */ 0xFF : /* intermediate: set FIN/PSH */ ~9);
-
-	  // Move packet data
-	  if (data_sent != 0) memmove(packet + header_len,
-				      packet + header_len + data_sent,
-				      chunk_size);
-	  
-	  // At this point we have prepared the final packet, we just
-	  // need to fix checksums and off it goes...
-	  uint32 segment_len = header_len + chunk_size;
-	  apply_offload(packet, segment_len, desc);
-	  MessageNetwork m(packet, segment_len, 0);
-	  parent->_net.send(m);
-
-	  // Prepare next chunk
-	  data_sent += chunk_size;
-	  if (!ipv6) packet_ip4_id = hton16(ntoh16(packet_ip4_id) + 1);
-	  if (l4t == tx_desc::L4T_TCP) packet_tcp_seq = hton32(ntoh32(packet_tcp_seq) + chunk_size);
-	  i++;
-	}
-	//Logging::panic("INSPECT");
-      }
-    }
-
-    void apply_offload(uint8 *packet, uint32 packet_len,
-                       const tx_desc &tx_desc)
+    void send_packet(uint8 *packet, uint32 packet_len,
+		     const tx_desc &desc, bool tse)
     {
-      uint8 popts = tx_desc.popts();
-      // Short-Circuit return, if no interesting offloads are to be done.
-      if ((popts & 7) == 0) return;
-
-      unsigned cc  = tx_desc.idx();
-      uint16 tucmd = ctx[cc].tucmd();
-      uint16 iplen = ctx[cc].iplen();
-      uint8 maclen = ctx[cc].maclen();
-
-      // Sanity check maclen and iplen. We only cover the case that is
-      // harmful to us.
-      if ((maclen+iplen > packet_len)) 
+      // The payload length in the TX descriptor does not include the
+      // prototype header for TCP segmentation.
+      if (!tse && desc.paylen() != packet_len) {
+	Logging::printf("XXX Got %x bytes, but payload size is %x. Huh? Ignoring packet.\n", packet_len, desc.paylen());
 	return;
+      }
 
-      if ((popts & 4) != 0 /* IPSEC */) {
+      const tx_desc &cur_ctx = ctx[desc.idx()];
+      uint8 popts = desc.popts();
+      if ((popts & tx_desc::POPTS_IPSEC) != 0) {
         Logging::printf("XXX IPsec offload requested. Not implemented!\n");
         // Since we don't do IPsec, we can skip the rest, too.
-        return;
+        popts = 0;
       }
 
-      if (((popts & 1 /* IXSM     */) != 0) &&
-          ((tucmd & 2 /* IPv4 CSO */) != 0)) {
-	uint16 &ipv4_sum = *reinterpret_cast<uint16 *>(packet + maclen + 10);
-	ipv4_sum = 0;
-	ipv4_sum = IPChecksum::ipsum(packet, maclen, iplen);
+      NetOffload o;
+      o.ipv6   = (cur_ctx.tucmd() & tx_desc::TUCMD_IPV4) == 0;
+      o.maclen = cur_ctx.maclen();
+      o.iplen  = cur_ctx.iplen();
+      o.l4len  = tse ? cur_ctx.l4len() : 0;
+      o.mss    = cur_ctx.mss();
+      switch (cur_ctx.l4t()) {
+      case tx_desc::L4T_UDP: o.l4 = NetOffload::L4_UDP; break;
+      case tx_desc::L4T_TCP: o.l4 = NetOffload::L4_TCP; break;
+      case tx_desc::L4T_SCTP:
+	if (tse || (popts & tx_desc::POPTS_TXSM))
+	  Logging::printf("XXX SCTP offload requested. Not implemented!\n");
+	if (tse) return;
+	break;
+      }
+      if ((popts & tx_desc::POPTS_IXSM) != 0) o.flags |= NetOffload::CSUM_IP4;
+      if ((popts & tx_desc::POPTS_TXSM) != 0) o.flags |= NetOffload::CSUM_L4;
+      if (tse)                                o.flags |= NetOffload::SEGMENT;
+
+      NetFragment  frag = { packet, packet_len };
+      NetSegmenter seg;
+      if (!o.flags || !seg.init(o, &frag, 1)) {
+	if (tse) {
+	  Logging::printf("XXX Bad segmentation context. Ignoring packet.\n");
+	  return;
+	}
+	MessageNetwork m(packet, packet_len, 0);
+	parent->_net.send(m);
+	return;
       }
 
-      if ((popts & 2 /* TXSM */) != 0) {
-        // L4 offload requested. Figure out packet type.
-        uint8 l4t = (tucmd >> 2) & 3;
-
-        switch (l4t) {
-        case tx_desc::L4T_UDP:		// UDP
-        case tx_desc::L4T_TCP:		// TCP
-          {
-            uint8 *l4_sum = packet + maclen + iplen + ((l4t == tx_desc::L4T_UDP) ? 6 : 16);
-            l4_sum[0] = l4_sum[1] = 0;
-            uint16 sum = IPChecksum::tcpudpsum(packet, (l4t == tx_desc::L4T_UDP) ? 17 : 6, maclen, iplen, packet_len,
-                                               (tucmd & 2 /* IPv4 */) == 0);
-	    l4_sum[0] = sum;
-	    l4_sum[1] = sum>>8;
-          }
-          break;
-        case tx_desc::L4T_SCTP:		// SCTP
-          Logging::printf("XXX SCTP CSO requested. Not implemented!\n");
-          break;
-        case 3:
-          // Invalid. Nothing to be done.
-          break;
-        }
+      size_t segment_len;
+      while ((segment_len = seg.next(segment_buf, sizeof(segment_buf)))) {
+	MessageNetwork m(segment_buf, segment_len, 0);
+	parent->_net.send(m);
       }
     }
 
@@ -330,7 +282,7 @@ class Model82576vf : public StaticReceiver<Model82576vf>
       packet_cur += data_len;
 
       if (dcmd & EOP) {
-	apply_segmentation(packet_buf, packet_cur, desc, (dcmd & TSE) != 0);
+	send_packet(packet_buf, packet_cur, desc, (dcmd & TSE) != 0);
         packet_cur = 0;
       }
 
@@ -342,16 +294,19 @@ class Model82576vf : public StaticReceiver<Model82576vf>
         parent->TX_irq(n);
     }
 
-    void tdt_poll()
+    /**
+     * Process queued descriptors. Returns how many were found.
+     */
+    unsigned tdt_poll()
     {
       if ((regs[TXDCTL] & (1<<25)) == 0) {
 	//if (n == 0) Logging::printf("TX: Queue %u not enabled.\n", n);
-	return;
+	return 0;
       }
       uint32 tdlen = regs[TDLEN];
       if (tdlen == 0) {
 	//if (n == 0) Logging::printf("TX: Queue %u has zero size.\n", n);
-	return;
+	return 0;
       }
 
       uint32 tdbah = regs[TDBAH];
@@ -359,12 +314,14 @@ class Model82576vf : public StaticReceiver<Model82576vf>
 
       // Packet send loop.
       uint32 tdh;
+      unsigned found = 0;
       while ((tdh = regs[TDH]) != regs[TDT]) {
+	found++;
 	uint64 addr = (static_cast<uint64>(tdbah)<<32 | tdbal) + ((tdh*16) % tdlen);
 	tx_desc desc;
 
 	if (!parent->copy_in(addr, desc.raw, sizeof(desc)))
-	  return;
+	  return found;
 	if ((desc.raw[1] & (1<<29)) == 0) {
 	  Logging::printf("TX legacy descriptor: Not implemented!\n");
 	} else {
@@ -381,6 +338,7 @@ class Model82576vf : public StaticReceiver<Model82576vf>
 	VMM_MEMORY_BARRIER;
 	regs[TDH] = (((tdh+1)*16 ) % tdlen) / 16;
       }
+      return found;
     }
 
     uint32 read(uint32 offset)
@@ -395,7 +353,10 @@ class Model82576vf : public StaticReceiver<Model82576vf>
       unsigned i = (offset & 0x8FF) / 4;
       regs[i] = val;
       if (i == TXDCTL) txdctl_poll();
-      if (i == TDT) tdt_poll();
+      if (i == TDT) {
+	parent->tx_doorbell();
+	tdt_poll();
+      }
       
     }
 
@@ -756,53 +717,110 @@ public:
   }
 
   // XXX Clean up!
-  bool receive(MessageMem &msg)
+  bool mmio(bool read, uintptr_t phys, unsigned *ptr)
   {
     // Memory decode disabled?
     if ((rPCISTSCTRL & 2) == 0) return false;
 
-    if (msg.read) {
-      if ((msg.phys & ~0x3FFF) == (rPCIBAR0 & ~0x3FFF)) {
-	uint32 offset = msg.phys - (rPCIBAR0 & ~0x3FFF);
+    if (read) {
+      if ((phys & ~0x3FFF) == (rPCIBAR0 & ~0x3FFF)) {
+	uint32 offset = phys - (rPCIBAR0 & ~0x3FFF);
 	//Logging::printf("MMIO READ  %lx\n", offset);
 	switch (offset >> 12) {
-	case 2:  *msg.ptr = _rx_queues[(offset & 0x100) ? 1 : 0].read(offset); break;
-	case 3:  *msg.ptr = _tx_queues[(offset & 0x100) ? 1 : 0].read(offset); break;
-	default: *msg.ptr = MMIO_read(offset); break;
+	case 2:  *ptr = _rx_queues[(offset & 0x100) ? 1 : 0].read(offset); break;
+	case 3:  *ptr = _tx_queues[(offset & 0x100) ? 1 : 0].read(offset); break;
+	default: *ptr = MMIO_read(offset); break;
 	}
-      } else if ((msg.phys & ~0xFFF) == (rPCIBAR3 & ~0xFFF)) {
-	*msg.ptr = MSIX_read(msg.phys - (rPCIBAR3 & ~0xFFF));
+      } else if ((phys & ~0xFFF) == (rPCIBAR3 & ~0xFFF)) {
+	*ptr = MSIX_read(phys - (rPCIBAR3 & ~0xFFF));
       } else return false;
       return true;
     }
 
-    if ((msg.phys & ~0x3FFF) == (rPCIBAR0 & ~0x3FFF)) {
-      uint32 offset = msg.phys - (rPCIBAR0 & ~0x3FFF);
+    if ((phys & ~0x3FFF) == (rPCIBAR0 & ~0x3FFF)) {
+      uint32 offset = phys - (rPCIBAR0 & ~0x3FFF);
       //Logging::printf("MMIO WRITE %lx\n", offset);
       switch (offset >> 12) {
-      case 2: _rx_queues[(offset & 0x100) ? 1 : 0].write(offset, *msg.ptr); break;
-      case 3: _tx_queues[(offset & 0x100) ? 1 : 0].write(offset, *msg.ptr); break;
-      default: MMIO_write(msg.phys - (rPCIBAR0 & ~0x3FFF), *msg.ptr); break;
+      case 2: _rx_queues[(offset & 0x100) ? 1 : 0].write(offset, *ptr); break;
+      case 3: _tx_queues[(offset & 0x100) ? 1 : 0].write(offset, *ptr); break;
+      default: MMIO_write(phys - (rPCIBAR0 & ~0x3FFF), *ptr); break;
       }
-    } else if ((msg.phys & ~0xFFF) == (rPCIBAR3 & ~0xFFF)) {
-      MSIX_write(msg.phys - (rPCIBAR3 & ~0xFFF), *msg.ptr);
+    } else if ((phys & ~0xFFF) == (rPCIBAR3 & ~0xFFF)) {
+      MSIX_write(phys - (rPCIBAR3 & ~0xFFF), *ptr);
     } else return false;
     return true;
   }
 
+  bool receive(MessageMem &msg)
+  {
+    // wide accesses, e.g. to the 64-bit queue base addresses, are split here
+    for (unsigned i = 0; i < msg.len / 4; i++)
+      if (!mmio(msg.read, msg.phys + i*4, msg.ptr + i)) return false;
+    return true;
+  }
+
   bool receive(MessageNetwork &msg)
   {
     // XXX Hack. Avoid our own packets.
-    if (!(((msg.buffer < _tx_queues[0].packet_buf) ||
-	   (msg.buffer >= (_tx_queues[0].packet_buf + sizeof(_tx_queues[0].packet_buf)))) &&
-	  ((msg.buffer < _tx_queues[1].packet_buf) ||
-	   (msg.buffer >= (_tx_queues[1].packet_buf + sizeof(_tx_queues[1].packet_buf))))))
+    if (_tx_queues[0].owns(msg.buffer) || _tx_queues[1].owns(msg.buffer))
       return false;
 
     _rx_queues[0].receive_packet(const_cast<uint8 *>(msg.buffer), msg.len);
     return true;
   }
 
+  /**
+   * A trapped TDT write. Switch to polling if they come too often.
+   */
+  void tx_doorbell()
+  {
+    COUNTER_INC("82576vf TX trap");
+    if (!_txadaptive || _txpolling) return;
+
+    timevalue now = _clock->clock(1000000);
+    if (now - _txwindow > TXADAPT_WINDOW) {
+      _txwindow    = now;
+      _txdoorbells = 0;
+    }
+    if (++_txdoorbells < TXADAPT_RATE) return;
+
+    Logging::printf("82576VF: switching TX to polled mode\n");
+    _txpolling = true;
+    _txpoll_us = TXPOLL_MIN_US;
+    _txidle    = 0;
+    reprogram_timer();
+  }
+
+  /**
+   * The guest stopped sending. Take the TX registers back so that TDT
+   * writes trap again. Returns false if the host can not revoke them.
+   */
+  bool tx_trap()
+  {
+    // refuse the page before the guest can fault it in again
+    _txpolling = false;
+
+    MessageHostOp msg(MessageHostOp::OP_REVOKE_MEMREGION, _mem_mmio + 0x3000UL, 0x1000);
+    msg.ptr = reinterpret_cast<char *>(_local_tx_regs);
+    if (!_bus_hostop.send(msg)) {
+      Logging::printf("82576VF: can not revoke TX registers, staying in polled mode\n");
+      _txpolling  = true;
+      _txadaptive = false;
+      return false;
+    }
+
+    // pick up descriptors posted before the mapping was gone
+    for (unsigned i = 0; i < 2; i++) {
+      _tx_queues[i].txdctl_poll();
+      _tx_queues[i].tdt_poll();
+    }
+
+    Logging::printf("82576VF: switching TX to trapped mode\n");
+    _txwindow    = _clock->clock(1000000);
+    _txdoorbells = 0;
+    return true;
+  }
+
   void reprogram_timer()
   {
     assert(_txpoll_us != 0);
@@ -821,7 +839,7 @@ public:
       msg.count = 1;
       break;
     case 0x3:
-      if (_txpoll_us != 0) {
+      if (_txpolling) {
 	msg.ptr =  reinterpret_cast<char *>(_local_tx_regs);
 	msg.start_page = msg.page;
 	msg.count = 1;
@@ -830,8 +848,7 @@ public:
 
 	break;
       } else {
-	// If _txpoll_us is zero, we don't map TX registers and don't
-	// need to poll.
+	// If we are not polling, we don't map TX registers.
 	// FALLTHROUGH
       }
     default:
@@ -846,9 +863,23 @@ public:
   {
     if (msg.nr != _timer_nr) return false;
 
+    unsigned found = 0;
     for (unsigned i = 0; i < 2; i++) {
       _tx_queues[i].txdctl_poll();
-      _tx_queues[i].tdt_poll();
+      found += _tx_queues[i].tdt_poll();
+    }
+
+    COUNTER_INC("82576vf TX poll");
+    if (!found) COUNTER_INC("82576vf TX empty poll");
+    if (_txadaptive) {
+      if (found >= TXPOLL_BATCH)
+        _txpoll_us = VMM_MAX(_txpoll_us / 2, unsigned(TXPOLL_MIN_US));
+      else if (!found)
+        _txpoll_us = VMM_MIN(_txpoll_us * 2, unsigned(TXPOLL_MAX_US));
+
+      // stop polling an idle queue, its TDT writes trap again
+      _txidle = found ? 0 : _txidle + 1;
+      if (_txidle >= TXPOLL_IDLE && tx_trap()) return true;
     }
 
     reprogram_timer();
@@ -886,15 +917,16 @@ public:
     return false;
   }
 
-  Model82576vf(uint64 mac, DBus<MessageNetwork> &net,
+  Model82576vf(uint64 mac, DBus<MessageNetwork> &net, DBus<MessageHostOp> &bus_hostop,
 	       DBus<MessageMem> *bus_mem, DBus<MessageMemRegion> *bus_memregion,
 	       Clock *clock, DBus<MessageTimer> &timer,
-	       uint32 mem_mmio, uint32 mem_msix, unsigned txpoll_us, bool map_rx, unsigned bdf,
+	       uint32 mem_mmio, uint32 mem_msix, unsigned txpoll_us, bool txadaptive, bool map_rx, unsigned bdf,
 	       bool promisc_default)
-    : _mac(mac), _net(net), _bus_memregion(bus_memregion), _bus_mem(bus_mem),
+    : _mac(mac), _net(net), _bus_hostop(bus_hostop), _bus_memregion(bus_memregion), _bus_mem(bus_mem),
       _clock(clock), _timer(timer),
       _mem_mmio(mem_mmio), _mem_msix(mem_msix),
-      _txpoll_us(txpoll_us), _map_rx(map_rx), _bdf(bdf),
+      _txpoll_us(txpoll_us), _txadaptive(txadaptive), _txpolling(!txadaptive && txpoll_us),
+      _txwindow(), _txdoorbells(), _txidle(), _map_rx(map_rx), _bdf(bdf),
       _promisc_default(promisc_default)
   {
     Logging::printf("Attached 82576VF model at %08x+0x4000, %08x+0x1000\n",
@@ -912,7 +944,7 @@ public:
     device_reset();
 
     // Program timer
-    MessageTimer msgt;
+    MessageTimer msgt(this, &Model82576vf::receive_static<MessageTimeout>);
     if (!_timer.send(msgt))
       Logging::panic("%s can't get a timer", __PRETTY_FUNCTION__);
     _timer_nr = msgt.nr;
@@ -921,10 +953,11 @@ public:
 };
 
 PARAM_HANDLER(intel82576vf,
-	      "intel82576vf:[promisc][,mem_mmio][,mem_msix][,txpoll_us][,rx_map] - attach an Intel 82576VF to the PCI bus.",
+	      "intel82576vf:[promisc][,mem_mmio][,mem_msix][,txpoll_us][,rx_map][,txadaptive] - attach an Intel 82576VF to the PCI bus.",
 	      "promisc   - if !=0, be always promiscuous (use for Linux VMs that need it for bridging) (Default 1)",
 	      "txpoll_us - if !=0, map TX registers to guest and poll them every txpoll_us microseconds. (Default 0)",
 	      "rx_map    - if !=0, map RX registers to guest. (Default: Yes)",
+	      "txadaptive - if !=0, trap TX registers while the guest sends little and poll them while it streams. (Default 0)",
 	      "Example: intel82576vf"
 	      )
 {
@@ -932,11 +965,12 @@ PARAM_HANDLER(intel82576vf,
   if (!mb.bus_hostop.send(msg)) Logging::panic("Could not get a MAC address");
 
   Model82576vf *dev = new Model82576vf(hton64(msg.mac) >> 16,
-				       mb.bus_network, &mb.bus_mem, &mb.bus_memregion,
+				       mb.bus_network, mb.bus_hostop, &mb.bus_mem, &mb.bus_memregion,
 				       mb.clock(), mb.bus_timer,
 				       (argv[1] == ~0UL) ? 0xF7CE0000 : argv[1],
 				       (argv[2] == ~0UL) ? 0xF7CC0000 : argv[2],
 				       (argv[3] == ~0UL) ? 0 : argv[3],
+				       (argv[5] == ~0UL) ? false : (argv[5] != 0),
 				       argv[4],
 				       PciHelper::find_free_bdf(mb.bus_pcicfg, ~0U),
 				       (argv[0] == ~0UL) ? true : (argv[0] != 0) );
@@ -192,6 +192,7 @@ private:
 
 public:
   bool  receive(MessageMem &msg) {
+    if (msg.wide()) return false;
     if (!in_range(msg.phys, _base, 0x100) &&
 	// all IOApics should get the broadcast EOI from the LAPIC
 	msg.phys != MessageApic::IOAPIC_EOI) return false;
@@ -260,7 +261,7 @@ public:
   {
     reset();
     _mb.bus_mem.add(this,       receive_static<MessageMem>);
-    _mb.bus_irqlines.add(this,  receive_static<MessageIrqLines>);
+    _mb.bus_irqlines.add_range(this, receive_static<MessageIrqLines>, _gsibase, PINS);
     _mb.bus_legacy.add(this,    receive_static<MessageLegacy>);
     _mb.bus_discovery.add(this, discover);
   };
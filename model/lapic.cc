@@ -20,13 +20,14 @@
 #include "model/config.h"
 #include "nul/motherboard.h"
 #include "nul/vcpu.h"
+#include "model/tickpolicy.h"
 
 /**
  * Lapic model.
  *
  * State: testing
- * Features: MEM, MSR, MSR-base and CPUID, LVT, LINT0/1, EOI, prioritize IRQ, error, RemoteEOI, timer, IPI, lowest prio, reset, x2apic mode, BIOS ACPI tables
- * Missing:  focus checking, CR8/TPR setting
+ * Features: MEM, MSR, MSR-base and CPUID, LVT, LINT0/1, EOI, prioritize IRQ, error, RemoteEOI, timer, IPI, lowest prio, reset, x2apic mode, BIOS ACPI tables, TPR shadow
+ * Missing:  focus checking, CR8 setting
  * Difference:  no interrupt polarity, lowest prio is round-robin
  * Documentation: Intel SDM Volume 3a Chapter 10 253668-033.
  */
@@ -52,6 +53,7 @@ private:
   unsigned  _initial_apic_id;
   unsigned  _timer;
   unsigned  _timer_clock_shift;
+  TickPolicy _ticks;
 
   // dynamic state
   unsigned  _timer_dcr_shift;
@@ -90,6 +92,7 @@ private:
     _isrv = 0;
     _esr_shadow = 0;
     _lowest_rr = 0;
+    _vcpu->tpr.value = 0;
 
 
     _ID = old_id;
@@ -137,6 +140,9 @@ private:
 
     _msr = value;
 
+    // the TPR shadow is only accessible in xAPIC mode
+    _vcpu->tpr.phys = ((_msr & 0xc00) == 0x800) ? uintptr_t(_msr & ~0xfffull) + 0x80 : ~0ul;
+
     // init _ID on mode switches
     if (!was_x2apic_mode && x2apic_mode()) {
       _ID = _initial_apic_id;
@@ -152,26 +158,31 @@ private:
    * Checks whether a timeout should trigger and returns the current
    * counter value.
    */
-  unsigned get_ccr(timevalue now) {
+  unsigned get_ccr(timevalue now, bool *fired = 0) {
     if (!_ICT || !_timer_start)  return 0;
 
     timevalue delta = (now - _timer_start) >> _timer_dcr_shift;
     if (delta < _ICT)  return _ICT - delta;
 
-    // we need to trigger the timer LVT
-    trigger_lvt(_TIMER_offset - LVT_BASE);
-
     // one shot?
     if (~_TIMER & (1 << 17))  {
+      trigger_lvt(_TIMER_offset - LVT_BASE);
+      if (fired) *fired = true;
       _timer_start = 0;
       return 0;
     }
 
-    // add periods to the time we started to detect the next overflow
-    unsigned done = delta % _ICT;
-    _timer_start += timevalue((delta - done)) << _timer_dcr_shift;
+    // the tick policy moves the start of the period
+    if (_ticks.due(_timer_start, timevalue(_ICT) << _timer_dcr_shift, now)) {
+      trigger_lvt(_TIMER_offset - LVT_BASE);
+      if (fired) *fired = true;
+    }
+    COUNTER_SET("lapic missed", _ticks.missed);
+    COUNTER_SET("lapic lost",   _ticks.lost);
 
-    return _ICT - done;
+    // still behind?
+    delta = (now - _timer_start) >> _timer_dcr_shift;
+    return delta < _ICT ? _ICT - delta : 1;
   }
 
   /**
@@ -180,7 +191,9 @@ private:
   void update_timer(timevalue now) {
     unsigned value = get_ccr(now);
     if (!value || _TIMER & (1 << LVT_MASK_BIT)) return;
-    MessageTimer msg(_timer, now + (timevalue(value) << _timer_dcr_shift));
+    timevalue to = now + (timevalue(value) << _timer_dcr_shift);
+    if (_TIMER & (1 << 17))  to = _ticks.next(_timer_start, timevalue(_ICT) << _timer_dcr_shift, now);
+    MessageTimer msg(_timer, to);
     _mb.bus_timer.send(msg);
   }
 
@@ -260,7 +273,7 @@ private:
    */
   unsigned processor_prio() {
     unsigned res = _isrv & 0xf0;
-    if (_TPR >= res) res = _TPR;
+    if (_vcpu->tpr.value >= res) res = _vcpu->tpr.value;
     return res;
   }
 
@@ -290,6 +303,9 @@ private:
   void update_irqs() {
     COUNTER_INC("update irqs");
 
+    // a TPR write is only relevant if it unblocks or blocks the highest IRR
+    unsigned irrc = get_highest_bit(OFS_IRR) & 0xf0;
+    _vcpu->tpr.threshold = irrc > (_isrv & 0xf0) ? irrc : 0;
 
     if (hw_disabled()) return;
 
@@ -352,6 +368,9 @@ private:
     COUNTER_INC("lapic read");
     bool res = true;
     switch (offset) {
+    case 0x08:
+      value = _vcpu->tpr.value;
+      break;
     case 0x0a:
       value = processor_prio();
       break;
@@ -387,6 +406,10 @@ private:
     case 0xc: // RRD
       // the accesses are ignored
       return true;
+    case 0x8: // TPR
+      if (strict && value & ~0xff) return false;
+      if (_vcpu->tpr.write(value & 0xff)) update_irqs();
+      return true;
     case 0xb: // EOI
       COUNTER_INC("lapic eoi");
       if (strict && value) return false;
@@ -517,6 +540,7 @@ public:
    */
   bool  receive(MessageMem &msg)
   {
+    if (msg.wide()) return false;
     if (((_msr & 0xc00) != 0x800) || !in_range(msg.phys, _msr & ~0xfffull, 0x1000)) return false;
     if ((msg.phys & 0xf) || (msg.phys & 0xfff) >= 0x400) return false;
 
@@ -550,8 +574,11 @@ public:
     if (hw_disabled() || msg.nr != _timer) return false;
 
     // no need to call update timer here, as the CPU needs to do an
-    // EOI first
-    get_ccr(_mb.clock()->time());
+    // EOI first, unless the tick policy did not deliver a tick
+    timevalue now = _mb.clock()->time();
+    bool fired = false;
+    get_ccr(now, &fired);
+    if (!fired) update_timer(now);
     return true;
   }
 
@@ -608,6 +635,8 @@ public:
       reset();
     else if (msg.type == LapicEvent::INIT)
       init();
+    else if (msg.type == LapicEvent::TPR)
+      update_irqs();
     return true;
   }
 
@@ -739,8 +768,15 @@ public:
   }
 
 
-  Lapic(Motherboard &mb, VCpu *vcpu, unsigned initial_apic_id, unsigned timer) : _mb(mb), _vcpu(vcpu), _initial_apic_id(initial_apic_id), _timer(timer)
+  Lapic(Motherboard &mb, VCpu *vcpu, unsigned initial_apic_id, unsigned policy)
+    : _mb(mb), _vcpu(vcpu), _initial_apic_id(initial_apic_id), _ticks(policy)
   {
+    // allocate a timer
+    MessageTimer msg0(this, receive_static<MessageTimeout>);
+    if (!mb.bus_timer.send(msg0))
+      Logging::panic("%s can't get a timer", __PRETTY_FUNCTION__);
+    _timer = msg0.nr;
+
     // find a FREQ that is not too high
     for (_timer_clock_shift=0; _timer_clock_shift < 32; _timer_clock_shift++)
       if ((_mb.clock()->freq() >> _timer_clock_shift) <= MAX_FREQ) break;
@@ -772,19 +808,16 @@ public:
 
 
 PARAM_HANDLER(lapic,
-	      "lapic:inital_apic_id - provide an x2APIC for the last VCPU",
+	      "lapic:inital_apic_id,policy - provide an x2APIC for the last VCPU",
 	      "Example: 'lapic:2'",
-	      "If no inital_apic_id is given the lapic number is used.")
+	      "If no inital_apic_id is given the lapic number is used.",
+	      "The lost-tick policy of the timer is 0=discard, 1=merge (default), 2=delay or 3=catchup.")
 {
   if (!mb.last_vcpu) Logging::panic("no VCPU for this APIC");
 
-  // allocate a timer
-  MessageTimer msg0;
-  if (!mb.bus_timer.send(msg0))
-    Logging::panic("%s can't get a timer", __PRETTY_FUNCTION__);
-
   static unsigned lapic_count;
-  new Lapic(mb, mb.last_vcpu, ~argv[0] ? argv[0]: lapic_count, msg0.nr);
+  new Lapic(mb, mb.last_vcpu, ~argv[0] ? argv[0]: lapic_count,
+	    ~argv[1] ? argv[1] : unsigned(TickPolicy::MERGE));
   lapic_count++;
 }
 
@@ -794,7 +827,6 @@ PARAM_HANDLER(lapic,
 VMM_REGSET(Lapic,
        VMM_REG_RW(_ID,            0x02,          0, 0xff000000,)
        VMM_REG_RO(_VERSION,       0x03, 0x01050014)
-       VMM_REG_RW(_TPR,           0x08,          0, 0xff,)
        VMM_REG_RW(_LDR,           0x0d,          0, 0xff000000,)
        VMM_REG_RW(_DFR,           0x0e, 0xffffffff, 0xf0000000,)
        VMM_REG_RW(_SVR,           0x0f, 0x000000ff, 0x11ff,     update_irqs();)
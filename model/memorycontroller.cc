@@ -31,10 +31,10 @@ public:
   /****************************************************/
   bool  receive(MessageMem &msg)
   {
-    if ((msg.phys < _start) || (msg.phys >= (_end - 4)))  return false;
-    unsigned *ptr = reinterpret_cast<unsigned *>(_physmem + msg.phys);
+    if ((msg.phys < _start) || (msg.phys > (_end - msg.len)))  return false;
+    char *ptr = _physmem + msg.phys;
 
-    if (msg.read) *msg.ptr = *ptr; else *ptr = *msg.ptr;
+    if (msg.read) memcpy(msg.ptr, ptr, msg.len); else memcpy(ptr, msg.ptr, msg.len);
     return true;
   }
 
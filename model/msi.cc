@@ -32,6 +32,7 @@ class Msi  : public StaticReceiver<Msi> {
 
 public:
   bool  receive(MessageMem &msg) {
+    if (msg.wide()) return false;
     if (!in_range(msg.phys, MessageMem::MSI_ADDRESS, 1 << 20)) return false;
 
     COUNTER_INC("MSI");
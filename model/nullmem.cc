@@ -34,7 +34,7 @@ public:
   bool  receive(MessageMem &msg)
   {
     if (!in_range(msg.phys, _base, _size)) return false;
-    if (msg.read) *msg.ptr = 0xffffffff;
+    if (msg.read) memset(msg.ptr, 0xff, msg.len);
     return true;
   }
 };
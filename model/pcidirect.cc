@@ -315,6 +315,7 @@ private:
   bool receive(MessageMem &msg)
   {
     unsigned *ptr;
+    if (msg.wide()) return false;
     if (!match_bars(msg.phys, 4, ptr))  return false;
     if (msg.read) {
       COUNTER_INC("PCID::READ");
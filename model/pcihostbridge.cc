@@ -58,6 +58,7 @@ public:
 
   bool receive(MessageIOIn &msg)
   {
+    if (msg.count) return false;
     bool res = true;
     if (msg.port == _iobase && msg.type == MessageIOIn::TYPE_INL)
       msg.value = _confaddress;
@@ -77,6 +78,7 @@ public:
      * this is a way to switch between PCI configuration method 2 and
      * 1.  We simply ignore the access.
      */
+    if (msg.count) return false;
     if (msg.port == _iobase + 3 && msg.type == MessageIOOut::TYPE_OUTB)
       return true;
 
@@ -118,6 +120,7 @@ public:
    * MMConfig access.
    */
   bool  receive(MessageMem &msg) {
+    if (msg.wide()) return false;
     if (!in_range(msg.phys, _membase, _buscount << 20)) return false;
 
     unsigned bdf = (msg.phys - _membase) >> 12;
@@ -245,8 +248,8 @@ PARAM_HANDLER(pcihostbridge,
 
   // ioport interface
   if (~argv[2]) {
-    mb.bus_ioin.add(dev,  PciHostBridge::receive_static<MessageIOIn>);
-    mb.bus_ioout.add(dev, PciHostBridge::receive_static<MessageIOOut>);
+    mb.bus_ioin.add(dev,  PciHostBridge::receive_static<MessageIOIn>,  argv[2], 8);
+    mb.bus_ioout.add(dev, PciHostBridge::receive_static<MessageIOOut>, argv[2], 8);
   }
 
   // MMCFG interface
@@ -257,7 +260,7 @@ PARAM_HANDLER(pcihostbridge,
 
   mb.bus_pcicfg.add(dev, PciHostBridge::receive_static<MessagePciConfig>);
   mb.bus_legacy.add(dev, PciHostBridge::receive_static<MessageLegacy>);
-  mb.bus_bios.add  (dev, PciHostBridge::receive_static<MessageBios>);
+  mb.bus_bios.add  (dev, PciHostBridge::receive_static<MessageBios>, 0x1a);
 }
 #else
 VMM_REGSET(PCI,
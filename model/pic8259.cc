@@ -46,10 +46,10 @@ class PicDevice : public StaticReceiver<PicDevice>
     ICW4_SFNM = 0x10,
   };
 
-  DBus<MessageIrqLines>  &_bus_irq;
+  DBusIrqLines  &_bus_irq;
   DBus<MessagePic> 	 &_bus_pic;
   DBus<MessageLegacy> 	 &_bus_legacy;
-  DBus<MessageIrqNotify> &_bus_notify;
+  DBusIrqNotify &_bus_notify;
   unsigned short _base;
   unsigned       _upstream_irq;
   unsigned short _elcr_base;
@@ -98,7 +98,7 @@ class PicDevice : public StaticReceiver<PicDevice>
     _isr = 0;         // no doc says this, but 2 machines tested
     _poll_mode = false;
     _elcr = (_icw[ICW1] & ICW1_LTIM) ? 0xff : 0;
-    _notify = 0;
+    // the IRR is cleared, thus pending notifies are sent out now
     propagate_irq(true);
   }
 
@@ -222,7 +222,7 @@ class PicDevice : public StaticReceiver<PicDevice>
 
   bool  receive(MessageIOIn &msg)
   {
-    if (!in_range(msg.port, _base, 2) && msg.port != _elcr_base || msg.type != MessageIOIn::TYPE_INB)
+    if (!in_range(msg.port, _base, 2) && msg.port != _elcr_base || msg.type != MessageIOIn::TYPE_INB || msg.count)
       return false;
 
     if (msg.port == _elcr_base)
@@ -248,7 +248,7 @@ class PicDevice : public StaticReceiver<PicDevice>
    */
   bool  receive(MessageIOOut &msg)
   {
-      if (!in_range(msg.port, _base, 2) && msg.port != _elcr_base || msg.type != MessageIOOut::TYPE_OUTB)
+      if (!in_range(msg.port, _base, 2) && msg.port != _elcr_base || msg.type != MessageIOOut::TYPE_OUTB || msg.count)
 	return false;
 
       if (msg.port == _elcr_base)
@@ -352,10 +352,10 @@ class PicDevice : public StaticReceiver<PicDevice>
     }
 
 
- PicDevice(DBus<MessageIrqLines> &bus_irq, DBus<MessagePic> &bus_pic, DBus<MessageLegacy> &bus_legacy, DBus<MessageIrqNotify> &bus_notify,
+ PicDevice(DBusIrqLines &bus_irq, DBus<MessagePic> &bus_pic, DBus<MessageLegacy> &bus_legacy, DBusIrqNotify &bus_notify,
 	   unsigned short base, unsigned char irq, unsigned short elcr_base, unsigned char virq) :
    _bus_irq(bus_irq), _bus_pic(bus_pic), _bus_legacy(bus_legacy), _bus_notify(bus_notify),
-   _base(base), _upstream_irq(irq), _elcr_base(elcr_base), _virq(virq), _icw_mode(OCW1)
+   _base(base), _upstream_irq(irq), _elcr_base(elcr_base), _virq(virq), _icw_mode(OCW1), _notify(0)
   {
     _icw[ICW1] = 0;
     reset_values();
@@ -380,9 +380,13 @@ PARAM_HANDLER(pic,
 				 argv[1],
 				 argv[2],
 				 virq);
-  mb.bus_ioin.    add(dev, PicDevice::receive_static<MessageIOIn>);
-  mb.bus_ioout.   add(dev, PicDevice::receive_static<MessageIOOut>);
-  mb.bus_irqlines.add(dev, PicDevice::receive_static<MessageIrqLines>);
+  mb.bus_ioin.    add(dev, PicDevice::receive_static<MessageIOIn>,  argv[0], 2);
+  mb.bus_ioout.   add(dev, PicDevice::receive_static<MessageIOOut>, argv[0], 2);
+  if (~argv[2]) {
+    mb.bus_ioin.  add(dev, PicDevice::receive_static<MessageIOIn>,  argv[2], 1);
+    mb.bus_ioout. add(dev, PicDevice::receive_static<MessageIOOut>, argv[2], 1);
+  }
+  mb.bus_irqlines.add_range(dev, PicDevice::receive_static<MessageIrqLines>, virq, 8);
   mb.bus_pic.     add(dev, PicDevice::receive_static<MessagePic>);
   if (!virq)
     mb.bus_legacy.add(dev, PicDevice::receive_static<MessageLegacy>);
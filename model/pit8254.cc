@@ -17,10 +17,18 @@
  */
 
 #include "nul/motherboard.h"
+#include "service/seqlock.h"
+#include "model/tickpolicy.h"
 
 /**
  * A single counter of a PIT.
  *
+ * The counter state is the start time of the current count plus the
+ * mode, such that reads are computed from a single clock sample.
+ * The host timer is only reprogrammed if the next output edge
+ * changes and not while an edge is still unacknowledged by the IRQ
+ * controllers, e.g. because the line is masked.
+ *
  * State: stable
  * Implementation Note: the access to the _modus variable is not SMP safe.
  * Documentation: Intel 82c54 - intel-82c54-timer.pdf
@@ -36,6 +44,19 @@ class PitCounter : public StaticReceiver<PitCounter>
     RW_HIGH      = 0x020,
     NULL_COUNT   = 0x040,
   };
+  /**
+   * The read state.  It is only changed with a cmpxchg, as
+   * PitDevice::read_fast reads the counters without the lock.
+   */
+  enum ReadState
+  {
+    RS_LATCH        = 0xffff,   ///< the latched counter value
+    RS_STATUS_SHIFT = 16,       ///< the latched status
+    RS_LSTATUS      = 1 << 24,
+    RS_LATCHED_LOW  = 1 << 25,
+    RS_LATCHED_HIGH = 1 << 26,
+    RS_READ_LOW     = 1 << 27,  ///< the high byte of the counter is next
+  };
   enum Features
   {
     FPERIODIC               = 1 << 0,
@@ -49,22 +70,24 @@ class PitCounter : public StaticReceiver<PitCounter>
   unsigned short _latch;
   unsigned short _new_counter;
   unsigned       _initial;
-  unsigned char  _latched_status;
+  unsigned       _rstate;
   struct {
-    unsigned char _read_low   : 1;
     unsigned char _wrote_low  : 1;
     unsigned char _stopped    : 1;
     unsigned char _stopped_out: 1;
     unsigned char _gate       : 1;
-    unsigned char _lstatus    : 1;
-    unsigned char _latched    : 2;
   };
   timevalue            _start;
+  timevalue            _armed;        ///< programmed edge in FREQ time, ~0 if none
+  bool                 _irq_pending;  ///< an edge was raised but not yet notified
   DBus<MessageTimer> * _bus_timer;
-  DBus<MessageIrqLines> * _bus_irq;
+  DBusIrqLines * _bus_irq;
   unsigned             _irq;
-  Clock                _clock;
+  Clock              * _clock;
   unsigned             _timer;
+  TickPolicy           _ticks;
+  timevalue            _edge;         ///< last periodic edge an IRQ was raised for
+  timevalue            _edge_start;   ///< the _start the edge belongs to
   static const long FREQ = 1193180;
 
   bool feature(Features f)
@@ -100,26 +123,51 @@ class PitCounter : public StaticReceiver<PitCounter>
     }
 
 
-  void disable_counting()
+  /**
+   * The current time in counter ticks.
+   */
+  timevalue ticks() { return _clock->clock(FREQ); }
+
+
+  void disable_counting(timevalue now)
   {
-    _latch = get_counter();
-    _stopped_out = feature(FPERIODIC) || get_out();
-    _start = _clock.clock(FREQ);
+    _latch = get_counter(now);
+    _stopped_out = feature(FPERIODIC) || get_out(now);
+    _start = now;
     _stopped = 1;
   }
 
 
+  /**
+   * Put the edge on the grid of a newly started count.
+   */
+  void sync_edge(timevalue t)
+  {
+    if (_edge_start == _start) return;
+    _edge_start = _start;
+    _edge = t + (_initial + _start - t) % _initial - _initial;
+  }
+
+
   /**
    * Rearm a new timeout.
    */
-  void update_timer()
+  void update_timer(timevalue t)
   {
-    if (_irq == ~0U)  return;
-    timevalue t = _clock.clock(FREQ);
+    if (_irq == ~0U || _irq_pending)  return;
     timevalue to= _start;
     if (feature(FPERIODIC))
-      to = t + (_initial + _start - t) % _initial;
-    MessageTimer msg(_timer, _clock.abstime((to < t) ? 0 : (to - t), FREQ));
+      {
+	sync_edge(t);
+	to = _ticks.next(_edge, _initial, t);
+      }
+    if (to < t) to = t;
+
+    // the very same edge is already programmed
+    if (to == _armed)  return;
+    _armed = to;
+    // round up, so that the edge is reached when the timeout fires
+    MessageTimer msg(_timer, Math::muldiv128(to, _clock->freq(), FREQ) + 1);
     _bus_timer->send(msg);
   }
 
@@ -127,15 +175,15 @@ class PitCounter : public StaticReceiver<PitCounter>
   /**
    * Get the current counter value.
    */
-  unsigned short get_counter()
+  unsigned short get_counter(timevalue now)
   {
     if (_stopped)  return _latch;
 
-    long long res = _start - _clock.clock(FREQ);
+    long long res = _start - now;
     if (_modus & BCD) res = (res % 10000);
 
     // are we still having an old value?
-    if (_start - _initial - 1 == _clock.clock(FREQ))
+    if (_start - _initial - 1 == now)
       return _latch;
 
     if (res <= 0)  load_counter();
@@ -145,14 +193,14 @@ class PitCounter : public StaticReceiver<PitCounter>
     return res;
   }
 
-  void reload_counter()
+  void reload_counter(timevalue now)
   {
-    _latch = get_counter();
-    _stopped_out = (_modus & 0xe) != 0 ? get_out() : 0;
+    _latch = get_counter(now);
+    _stopped_out = (_modus & 0xe) != 0 ? get_out(now) : 0;
     _stopped = 0;
-    _start = _clock.clock(FREQ) + _new_counter + 1;
+    _start = now + _new_counter + 1;
     load_counter();
-    update_timer();
+    update_timer(now);
   }
 
  public:
@@ -160,17 +208,20 @@ class PitCounter : public StaticReceiver<PitCounter>
   void read_back(unsigned char value)
   {
     // sync state
-    unsigned short counter = get_counter();
-    if (!(value & 0x20) && !_lstatus)
-      {
-	_latched_status = (_modus & 0x7f) | (get_out() << 7);
-	_lstatus = 1;
-      }
-    if (!(value & 0x10) && !_latched)
-      {
-	_latch = counter;
-	_latched = ((_modus & (RW_LOW | RW_HIGH))/RW_LOW);
-      }
+    timevalue now = ticks();
+    unsigned short counter = get_counter(now);
+    unsigned status = (_modus & 0x7f) | (get_out(now) << 7);
+    unsigned old = __atomic_load_n(&_rstate, __ATOMIC_ACQUIRE), rs;
+    bool latch;
+    do {
+      rs = old;
+      if (!(value & 0x20) && !(rs & RS_LSTATUS))
+	rs = (rs & ~(0xff << RS_STATUS_SHIFT)) | (status << RS_STATUS_SHIFT) | RS_LSTATUS;
+      latch = !(value & 0x10) && !(rs & (RS_LATCHED_LOW | RS_LATCHED_HIGH));
+      if (latch)
+	rs = (rs & ~RS_LATCH) | counter | ((_modus & (RW_LOW | RW_HIGH)) / RW_LOW) * RS_LATCHED_LOW;
+    } while (!__atomic_compare_exchange_n(&_rstate, &old, rs, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    if (latch) _latch = counter;
   }
 
 
@@ -185,12 +236,10 @@ class PitCounter : public StaticReceiver<PitCounter>
 	  {
 	    _modus = (_modus & ~0x3f) | (modus & 0x3f) | NULL_COUNT;
 	    _start = 0;
-	    disable_counting();
+	    disable_counting(ticks());
 	    _stopped_out = (_modus & 0xe) != 0;
 	    _wrote_low = 0;
-	    _read_low = 0;
-	    _lstatus = 0;
-	    _latched = 0;
+	    __atomic_store_n(&_rstate, 0, __ATOMIC_RELEASE);
 	  }
       }
     else
@@ -206,16 +255,17 @@ class PitCounter : public StaticReceiver<PitCounter>
     if (value == _gate)  return;
     _gate = value;
 
-    if (!value && feature(FGATE_DISABLE_COUNTING))  disable_counting();
+    timevalue now = ticks();
+    if (!value && feature(FGATE_DISABLE_COUNTING))  disable_counting(now);
     if (value)
       {
-	_stopped_out = get_out();
+	_stopped_out = get_out(now);
 	if (!feature(Features(FSOFTWARE_TRIGGER)))
-	  reload_counter();
+	  reload_counter(now);
 	else if (_stopped)
 	  {
 	    _initial = _latch ? _latch : 65536;
-	    _start = _clock.clock(FREQ) + _initial + 1;
+	    _start = now + _initial + 1;
 	    _stopped = 0;
 	  }
       }
@@ -224,64 +274,73 @@ class PitCounter : public StaticReceiver<PitCounter>
   /*
    * Returns true if out is high;
    */
-  bool get_out()
+  bool get_out(timevalue now)
   {
-    if (_stopped || _start - _initial -1 == _clock.clock(FREQ))
+    if (_stopped || _start - _initial -1 == now)
       return _stopped_out;
 
     if (feature(FCOUNTDOWN))
-      return _clock.clock(FREQ) >= _start;
+      return now >= _start;
     if (feature(FPERIODIC))
       if (!feature(FSQUARE_WAVE))
-	return get_counter() != 1;
+	return get_counter(now) != 1;
       else
-	return ((_clock.clock(FREQ) - _start + _initial) % _initial)*2 < _initial;
-    return _clock.clock(FREQ) != _start;
+	return ((now - _start + _initial) % _initial)*2 < _initial;
+    return now != _start;
   }
+  bool get_out() { return get_out(ticks()); }
 
   /**
-   * Read from the counter port.
+   * Read from the counter port.  The counter may be a snapshot of
+   * live, whose read state is used and updated.
    */
-  unsigned char read()
+  unsigned char read(PitCounter &live)
   {
     unsigned char value;
-    if (_lstatus)
-      {
-	value = _latched_status;
-	_lstatus = 0;
-      }
-    else if (_latched & 1)
-      {
-	value = s2bcd(_latch) & 0xff;
-	_latched--;
-      }
-    else if (_latched & 2)
-      {
-	value = (s2bcd(_latch) >> 8) & 0xff;
-	_latched = 0;
-      }
-    else if (_read_low)
-      {
-	value = (s2bcd(get_counter()) >> 8) & 0xff;
-	_read_low = 0;
-      }
-    else
-      {
-	if (_modus & RW_LOW)
-	  value = s2bcd(get_counter()) & 0xff;
-	else
-	  value = (s2bcd(get_counter()) >> 8) & 0xff;
-	if ((_modus & (RW_LOW | RW_HIGH)) == (RW_LOW | RW_HIGH))
-	  _read_low = 1;
-      }
+    unsigned old = __atomic_load_n(&live._rstate, __ATOMIC_ACQUIRE), rs;
+    do {
+      rs = old;
+      if (rs & RS_LSTATUS)
+	{
+	  value = rs >> RS_STATUS_SHIFT;
+	  rs &= ~RS_LSTATUS;
+	}
+      else if (rs & RS_LATCHED_LOW)
+	{
+	  value = s2bcd(rs & RS_LATCH) & 0xff;
+	  rs &= ~RS_LATCHED_LOW;
+	}
+      else if (rs & RS_LATCHED_HIGH)
+	{
+	  value = (s2bcd(rs & RS_LATCH) >> 8) & 0xff;
+	  rs &= ~RS_LATCHED_HIGH;
+	}
+      else if (rs & RS_READ_LOW)
+	{
+	  value = (s2bcd(get_counter(ticks())) >> 8) & 0xff;
+	  rs &= ~RS_READ_LOW;
+	}
+      else
+	{
+	  unsigned short counter = s2bcd(get_counter(ticks()));
+	  if (_modus & RW_LOW)
+	    value = counter & 0xff;
+	  else
+	    value = (counter >> 8) & 0xff;
+	  if ((_modus & (RW_LOW | RW_HIGH)) == (RW_LOW | RW_HIGH))
+	    rs |= RS_READ_LOW;
+	}
+    } while (!__atomic_compare_exchange_n(&live._rstate, &old, rs, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
     return value;
   }
+  unsigned char read() { return read(*this); }
 
   /**
    * Write to the counter port.
    */
   void write(unsigned char value)
   {
+    timevalue now = ticks();
     if (_wrote_low)
       {
 	_wrote_low = 0;
@@ -292,7 +351,7 @@ class PitCounter : public StaticReceiver<PitCounter>
 	if (_modus & RW_HIGH)
 	  {
 	    _wrote_low = 1;
-	    if (feature(Features(FSOFTWARE_TRIGGER | FCOUNTDOWN)) && !get_out()) disable_counting();
+	    if (feature(Features(FSOFTWARE_TRIGGER | FCOUNTDOWN)) && !get_out(now)) disable_counting(now);
 	  }
 	_new_counter = bcd2s(value) & 0xff;
 	if (_modus & RW_HIGH)
@@ -305,7 +364,7 @@ class PitCounter : public StaticReceiver<PitCounter>
     if (feature(FSOFTWARE_TRIGGER))
       {
 	if (_gate)
-	  reload_counter();
+	  reload_counter(now);
 	else
 	  _latch = _new_counter;
       }
@@ -313,9 +372,9 @@ class PitCounter : public StaticReceiver<PitCounter>
       if (feature(FPERIODIC) && _gate)
 	{
 	  if (_stopped)
-	    reload_counter();
+	    reload_counter(now);
 	  else
-	    _start = _clock.clock(FREQ) + get_counter();
+	    _start = now + get_counter(now);
 	}
   }
 
@@ -323,7 +382,11 @@ class PitCounter : public StaticReceiver<PitCounter>
   bool  receive(MessageIrqNotify &msg)
   {
     if (msg.baseirq != (_irq & ~7) || !(msg.mask & (1 << (_irq & 7)))) return false;
-    if (feature(FPERIODIC))  update_timer();
+    _irq_pending = false;
+
+    // rearm if there is another edge to come
+    timevalue now = ticks();
+    if (feature(FPERIODIC) || (!_stopped && _start > now))  update_timer(now);
     return true;
   }
 
@@ -332,7 +395,23 @@ class PitCounter : public StaticReceiver<PitCounter>
   {
     if (msg.nr == _timer)
       {
-	// a timeout has triggerd
+	_armed = ~0ull;
+	if (feature(FPERIODIC))
+	  {
+	    timevalue now = ticks();
+	    sync_edge(now);
+	    bool due = _ticks.due(_edge, _initial, now);
+	    COUNTER_SET("pit missed", _ticks.missed);
+	    COUNTER_SET("pit lost",   _ticks.lost);
+	    if (!due)
+	      {
+		update_timer(now);
+		return true;
+	      }
+	  }
+
+	// a timeout has triggerd, no new timeout until the edge is notified
+	_irq_pending = true;
 	MessageIrqLines msg1(MessageIrq::ASSERT_NOTIFY, _irq);
 	_bus_irq->send(msg1);
 	return true;
@@ -341,19 +420,24 @@ class PitCounter : public StaticReceiver<PitCounter>
   }
 
 
-  PitCounter(DBus<MessageTimer> *bus_timer, DBus<MessageIrqLines> *bus_irq, unsigned irq, Clock *clock)
-    : _modus(), _latch(), _new_counter(), _initial(), _latched_status(), _start(0), _bus_timer(bus_timer), _bus_irq(bus_irq), _irq(irq), _clock(*clock), _timer(0)
+  PitCounter(DBus<MessageTimer> *bus_timer, DBusIrqLines *bus_irq, unsigned irq, Clock *clock, unsigned policy)
+    : _modus(), _latch(), _new_counter(), _initial(), _rstate(), _start(0), _armed(~0ull), _irq_pending(false), _bus_timer(bus_timer), _bus_irq(bus_irq), _irq(irq), _clock(clock), _timer(0),
+      _ticks(policy), _edge(0), _edge_start(~0ull)
   {
-    assert(_clock.freq() != 0);
-    if (_irq != ~0U)
-      {
-	MessageTimer msg0;
-	if (!_bus_timer->send(msg0))
-	  Logging::panic("%s can't get a timer", __PRETTY_FUNCTION__);
-	_timer = msg0.nr;
-      };
+    assert(_clock->freq() != 0);
   }
-  PitCounter() : _clock(0) {}
+
+  /**
+   * Get a timer. This is done when the counter has its final address.
+   */
+  void alloc_timer()
+  {
+    MessageTimer msg0(this, receive_static<MessageTimeout>);
+    if (!_bus_timer->send(msg0))
+      Logging::panic("%s can't get a timer", __PRETTY_FUNCTION__);
+    _timer = msg0.nr;
+  }
+  PitCounter() : _rstate(), _armed(~0ull), _irq_pending(false), _clock(0), _edge(0), _edge_start(~0ull) {}
 };
 
 
@@ -369,6 +453,17 @@ class PitDevice : public StaticReceiver<PitDevice>
   unsigned       _addr;
   static const unsigned COUNTER = 3;
   PitCounter _c[COUNTER];
+  PitCounter _snapshot[COUNTER];
+  SeqLock    _seqlock;
+
+  /**
+   * Publish the counters for the fast reader.
+   */
+  void publish()
+  {
+    for (unsigned i=0; i < COUNTER; i++)
+      _seqlock.write(_snapshot[i], _c[i]);
+  }
 
  public:
 
@@ -382,6 +477,7 @@ class PitDevice : public StaticReceiver<PitDevice>
 	break;
       case MessagePit::SET_GATE:
 	_c[msg.pit - _addr].set_gate(msg.value);
+	publish();
 	break;
       default:
 	assert(0);
@@ -390,18 +486,36 @@ class PitDevice : public StaticReceiver<PitDevice>
   }
 
 
+  /**
+   * Read a counter from the snapshot without taking a lock.  Latches,
+   * the status and the byte order are kept in the live read state.
+   */
+  static bool read_fast(Device *dev, MessageIOIn &msg)
+  {
+    PitDevice *pit = static_cast<PitDevice *>(dev);
+    if (!in_range(msg.port, pit->_base, COUNTER) || msg.type != MessageIOIn::TYPE_INB || msg.count)
+      return false;
+
+    PitCounter counter;
+    pit->_seqlock.read(counter, pit->_snapshot[msg.port - pit->_base]);
+    msg.value = counter.read(pit->_c[msg.port - pit->_base]);
+    return true;
+  }
+
+
  bool  receive(MessageIOIn &msg)
  {
-   if (!in_range(msg.port, _base, COUNTER) || msg.type != MessageIOIn::TYPE_INB)
+   if (!in_range(msg.port, _base, COUNTER) || msg.type != MessageIOIn::TYPE_INB || msg.count)
      return false;
    msg.value = _c[msg.port - _base].read();
+   publish();
    return true;
  }
 
 
  bool  receive(MessageIOOut &msg)
  {
-   if (!in_range(msg.port, _base, COUNTER+1) || msg.type != MessageIOOut::TYPE_OUTB)
+   if (!in_range(msg.port, _base, COUNTER+1) || msg.type != MessageIOOut::TYPE_OUTB || msg.count)
      return false;
    if (msg.port == _base + COUNTER)
      {
@@ -415,38 +529,47 @@ class PitDevice : public StaticReceiver<PitDevice>
 	 }
        else
 	 _c[(msg.value >> 6) & 3].set_modus(msg.value);
+       publish();
        return true;
      }
    _c[msg.port - _base].write(msg.value);
+   publish();
    return true;
  }
 
 
-  PitDevice(Motherboard &mb, unsigned short base, unsigned irq, unsigned pit)
+  PitDevice(Motherboard &mb, unsigned short base, unsigned irq, unsigned pit, unsigned policy)
     : _base(base), _addr(pit*COUNTER)
   {
     for (unsigned i=0; i < COUNTER; i++)
       {
-	_c[i] = PitCounter(&mb.bus_timer, &mb.bus_irqlines, i ? ~0U : irq, mb.clock());
-	if (!i) mb.bus_irqnotify.add(&_c[i], PitCounter::receive_static<MessageIrqNotify>);
+	_c[i] = PitCounter(&mb.bus_timer, &mb.bus_irqlines, i ? ~0U : irq, mb.clock(), policy);
+	if (!i && irq < MessageIrq::LINES)
+	  mb.bus_irqnotify.add(&_c[i], PitCounter::receive_static<MessageIrqNotify>, irq);
+	if (!i && irq != ~0U) _c[i].alloc_timer();
 	if (!i) mb.bus_timeout.add(&_c[i],   PitCounter::receive_static<MessageTimeout>);
 	_c[i].set_gate(1);
       }
+    publish();
   }
 };
 
 
 PARAM_HANDLER(pit,
-	      "pit:iobase,irq - attach a PIT8254 to the system.",
-	      "Example: 'pit:0x40,0'")
+	      "pit:iobase,irq,policy - attach a PIT8254 to the system.",
+	      "Example: 'pit:0x40,0'",
+	      "The lost-tick policy is 0=discard, 1=merge (default), 2=delay or 3=catchup.")
 {
   static unsigned pit_count;
   PitDevice *dev = new PitDevice(mb,
 				 argv[0],
 				 argv[1],
-				 pit_count++);
+				 pit_count++,
+				 ~argv[2] ? argv[2] : unsigned(TickPolicy::MERGE));
 
-  mb.bus_ioin.add(dev,  PitDevice::receive_static<MessageIOIn>);
-  mb.bus_ioout.add(dev, PitDevice::receive_static<MessageIOOut>);
+  mb.bus_ioin.add(dev,  PitDevice::receive_static<MessageIOIn>,  argv[0], 4);
+  for (unsigned i=0; i < 3; i++)
+    mb.bus_ioin.add_fast(dev, PitDevice::read_fast, argv[0] + i);
+  mb.bus_ioout.add(dev, PitDevice::receive_static<MessageIOOut>, argv[0], 4);
   mb.bus_pit.add(dev,   PitDevice::receive_static<MessagePit>);
 } 
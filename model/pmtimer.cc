@@ -34,9 +34,12 @@ private:
   unsigned _iobase;
   enum { FREQ = 3579545 };
 public:
+  /**
+   * The counter is a function of the clock, thus reads need no lock.
+   */
   bool  receive(MessageIOIn &msg) {
 
-    if (msg.port != _iobase || msg.type != MessageIOIn::TYPE_INL)  return false;
+    if (msg.port != _iobase || msg.type != MessageIOIn::TYPE_INL || msg.count)  return false;
     msg.value = _mb.clock()->clock(FREQ);
     return true;
   }
@@ -54,7 +57,7 @@ public:
 
   PmTimer(Motherboard &mb, unsigned iobase) : _mb(mb), _iobase(iobase) {
 
-    _mb.bus_ioin.add(this,      receive_static<MessageIOIn>);
+    _mb.bus_ioin.add_fast(this, receive_static<MessageIOIn>, _iobase);
     _mb.bus_discovery.add(this, discover);
   }
 };
@@ -19,6 +19,8 @@
 #include "nul/motherboard.h"
 #include "service/time.h"
 #include "service/bcd.h"
+#include "service/seqlock.h"
+#include "model/tickpolicy.h"
 
 using namespace Bcd;
 
@@ -35,7 +37,7 @@ class Rtc146818 : public StaticReceiver<Rtc146818>
 {
   friend class RtcTest;
   DBus<MessageTimer>    &_bus_timer;
-  DBus<MessageIrqLines> &_bus_irqlines;
+  DBusIrqLines &_bus_irqlines;
   Clock                *_clock;
   unsigned              _timer;
   unsigned short        _iobase;
@@ -44,6 +46,27 @@ class Rtc146818 : public StaticReceiver<Rtc146818>
   unsigned char         _ram[128];
   timevalue             _offset;
   timevalue             _last;
+  timevalue             _next_update; ///< counter value of the next second boundary
+  timevalue             _seconds;     ///< wallclock seconds of the time registers
+  timevalue             _tm_seconds;  ///< seconds represented by _tm, ~0 if invalid
+  struct tm_simple      _tm;
+  TickPolicy            _ticks;
+  timevalue             _pedge;       ///< counter value of the last periodic IRQ
+  unsigned              _pedge_tics;  ///< the period of _pedge, 0 if not in sync
+
+  /**
+   * What the fast reader needs to know about the selected register.
+   */
+  struct Snapshot {
+    unsigned char index;
+    unsigned char value;
+    unsigned char ram_a;
+    unsigned char ram_b;
+    timevalue     offset;
+    timevalue     next_update;
+  };
+  Snapshot              _snapshot;
+  SeqLock               _seqlock;
 
   /**
    * Timing:
@@ -86,25 +109,31 @@ class Rtc146818 : public StaticReceiver<Rtc146818>
     return value;
   }
 
-  int get_divider()
+  int get_divider() { return get_divider(_ram[0xa]); }
+
+
+  static int get_divider(unsigned char ram_a)
   {
-    int divider = 25 - ((_ram[0xa] >> 4) & 7) * 5;
+    int divider = 25 - ((ram_a >> 4) & 7) * 5;
     if (divider >= 22)  divider = 22;
     return divider;
   }
 
 
-  timevalue get_counter()
+  static timevalue get_counter(Clock *clock, unsigned char ram_a, timevalue offset)
   {
-    timevalue value = _clock->clock(1 << 30);
+    timevalue value = clock->clock(1 << 30);
     // scale the counter with the divider
-    int divider = get_divider();
+    int divider = get_divider(ram_a);
     if (divider < 0)  return 0;
     value >>= divider;
-    return value - _offset;
+    return value - offset;
   }
 
 
+  timevalue get_counter() { return get_counter(_clock, _ram[0xa], _offset); }
+
+
   unsigned get_periodic_tics()
   {
     if (_ram[0xa] & 0xf && (_ram[0xa] & 0x60) != 0x60)
@@ -151,20 +180,32 @@ class Rtc146818 : public StaticReceiver<Rtc146818>
 
   /**
    * Update the time with the given seconds.
+   *
+   * The broken down time is cached, so that the common case of a
+   * single elapsed second only touches the seconds register.
    */
   void update_ram(timevalue seconds)
   {
-    struct tm_simple tm;
+    struct tm_simple &tm = _tm;
+    if (seconds == _tm_seconds + 1 && tm.sec < 59)
+      {
+	tm.sec++;
+	_tm_seconds = seconds;
+	_ram[0] = convert_bcd(tm.sec);
+	set_irqflags(_ram[0xc] | 0x10);
+	return;
+      }
     gmtime(seconds, &tm);
+    _tm_seconds = seconds;
     _ram[0] = convert_bcd(tm.sec);
     _ram[2] = convert_bcd(tm.min);
     _ram[4] = convert_bcd(tm.hour);
     if (~_ram[0xb] & 2)
       {
 	unsigned char pm = (tm.hour >= 12) << 7;
-	tm.hour %= 12;
-	if (!tm.hour) tm.hour = 12;
-	_ram[4] = pm | convert_bcd(tm.hour);
+	unsigned char hour = tm.hour % 12;
+	if (!hour) hour = 12;
+	_ram[4] = pm | convert_bcd(hour);
       }
     _ram[6] = convert_bcd(tm.wday);
     _ram[7] = convert_bcd(tm.mday);
@@ -240,36 +281,99 @@ class Rtc146818 : public StaticReceiver<Rtc146818>
   }
 
 
+  /**
+   * Set the counter value of the last update cycle and the derived
+   * next second boundary.
+   */
+  void set_last(timevalue last)
+  {
+    _last = last;
+    _next_update = (last / FREQ + 1) * FREQ;
+  }
+
+
+  /**
+   * The time registers were modified by the guest, thus the cached
+   * time has to be recomputed from the RAM.
+   */
+  void invalidate_time()
+  {
+    _seconds = get_ram_time();
+    _tm_seconds = ~0ull;
+  }
+
+
+  /**
+   * Put the periodic edge on the grid of the current rate.
+   */
+  void sync_periodic(timevalue now, unsigned tics)
+  {
+    if (_pedge_tics == tics) return;
+    _pedge_tics = tics;
+    _pedge = now - (now + tics/2) % tics;
+  }
+
+
   /**
    * Performs an update cycle and updates the time in the RAM.
+   *
+   * Within the same second only the periodic flag is computed. The
+   * position in the second is derived from the cached boundary.
    */
   unsigned update_cycle(timevalue now)
   {
-    timevalue seconds = now;
-
-    unsigned  fnow  = seconds % FREQ;
-    if ((_ram[0xa] & 0x60) == 0x60) return fnow;
+    if ((_ram[0xa] & 0x60) == 0x60) return now % FREQ;
 
-    unsigned  flast = _last % FREQ;
+    bool same_second = now < _next_update && now + FREQ >= _next_update;
+    unsigned  fnow  = same_second ? FREQ - (_next_update - now) : now % FREQ;
     unsigned  periodic_tics = get_periodic_tics();
+    if (periodic_tics && _ram[0xb] & 0x40)
+      {
+	// periodic IRQs follow the tick policy, a pending flag delays them
+	sync_periodic(now, periodic_tics);
+	if (~_ram[0xc] & 0x40 && _ticks.due(_pedge, periodic_tics, now))
+	  set_irqflags(_ram[0xc] | 0x40);
+	COUNTER_SET("rtc missed", _ticks.missed);
+	COUNTER_SET("rtc lost",   _ticks.lost);
+      }
+    else if (periodic_tics)
+      {
+	_pedge_tics = 0;
+	unsigned  flast = _last % FREQ;
+	if (((fnow - periodic_tics/2) / periodic_tics) != ((flast - periodic_tics/2) / periodic_tics))
+	  set_irqflags(_ram[0xc] | 0x40);
+      }
 
-    if (periodic_tics && ((fnow - periodic_tics/2) / periodic_tics) != ((flast - periodic_tics/2) / periodic_tics))
-      set_irqflags(_ram[0xc] | 0x40);
-    seconds /= FREQ;
+    if (same_second)
+      {
+	_last = now;
+	return fnow;
+      }
 
-    // update cycle if not SET and not in the very same second
+    // update cycle if not SET
+    timevalue seconds = now / FREQ;
     if (~_ram[0xb] & 0x80 && seconds != (_last / FREQ))
       {
-	timevalue last_seconds = get_ram_time();
-	seconds = last_seconds + seconds - (_last / FREQ);
-	update_ram(seconds);
-	if (next_alarm(last_seconds) <= seconds)  set_irqflags(_ram[0xc] | 0x20);
+	timevalue last_seconds = _seconds;
+	_seconds += seconds - (_last / FREQ);
+	update_ram(_seconds);
+	if (next_alarm(last_seconds) <= _seconds)  set_irqflags(_ram[0xc] | 0x20);
       }
-    _last = now;
+    set_last(now);
     return fnow;
   };
 
 
+  /**
+   * Publish the selected register for the fast reader.
+   */
+  void publish()
+  {
+    Snapshot s = { _index, _ram[_index], _ram[0xa], _ram[0xb], _offset, _next_update };
+    _seqlock.write(_snapshot, s);
+  }
+
+
   /**
    * Reprogram the next timer.
    */
@@ -278,7 +382,11 @@ class Rtc146818 : public StaticReceiver<Rtc146818>
     timevalue next = 0;
     unsigned periodic_tics = get_periodic_tics();
     if (_ram[0xb] & 0x40 && periodic_tics)
-      next = periodic_tics - (static_cast<unsigned>(now % FREQ) + periodic_tics/2) % periodic_tics;
+      {
+	sync_periodic(now, periodic_tics);
+	next = _ticks.next(_pedge, periodic_tics, now) - now;
+	if (!next) next = 1;
+      }
     else if (_ram[0xb] & 0x10)
       next = FREQ - now % FREQ;
     else if (_ram[0xb] & 0x20)
@@ -310,18 +418,23 @@ public:
     _ram[0xd] = 0x80; // Valid RAM and Time
 
     timevalue now = Math::muldiv128(time.wallclocktime - time.timestamp, FREQ, MessageTime::FREQUENCY);
-    update_ram(now / FREQ);
+    _seconds = now / FREQ;
+    _tm_seconds = ~0ull;
+    update_ram(_seconds);
     set_irqflags(0);
-    _offset = _last = 0;
+    _offset = 0;
+    set_last(0);
+    publish();
   }
 
 
   bool  receive(MessageIOIn &msg)
   {
-    if (!in_range(msg.port, _iobase, 8) || msg.type != MessageIOIn::TYPE_INB)
+    if (!in_range(msg.port, _iobase, 8) || msg.type != MessageIOIn::TYPE_INB || msg.count)
       return false;
     timevalue now = get_counter();
     unsigned mod = update_cycle(now);
+    publish();
     if (msg.port & 1)
       {
 	// the registers are not available during an update cycle!
@@ -340,7 +453,8 @@ public:
 	    break;
 	  case 0xc:
 	    set_irqflags(0);
-	    update_timer(get_ram_time(), now);
+	    update_timer(_seconds, now);
+	    publish();
 	    break;
 	  default:
 	    break;
@@ -356,7 +470,7 @@ public:
 
   bool  receive(MessageIOOut &msg)
   {
-    if (!in_range(msg.port, _iobase, 8) || msg.type != MessageIOOut::TYPE_OUTB)
+    if (!in_range(msg.port, _iobase, 8) || msg.type != MessageIOOut::TYPE_OUTB || msg.count)
       return false;
     if (msg.port & 1)
       {
@@ -375,7 +489,8 @@ public:
 		{
 		  // switch from reset to non-reset mode, the next update is a half second later...
 		  _offset  = _clock->clock(FREQ) - FREQ/2;
-		  _last    = FREQ/2; // to make sure the periodic updates are right!
+		  set_last(FREQ/2); // to make sure the periodic updates are right!
+		  _pedge_tics = 0;
 		}
 	    }
 	    break;
@@ -386,16 +501,49 @@ public:
 	    // enabled counting?
 	    if ((_ram[0xb] & 0x80) && ~msg.value & 0x80)
 	      // skip missed updates, but do not reset the divider chain
-	      _last = _clock->clock(FREQ);
+	      set_last(get_counter());
 	    // Fallthrough
 	  default:
 	    _ram[_index] = msg.value;
 	  }
-	if (_index < 0xc)  update_timer(get_ram_time(), get_counter());
+	if (_index < 0xc || _index == 0x32)  invalidate_time();
+	if (_index < 0xc)  update_timer(_seconds, get_counter());
 	if (_index == 0xb) set_irqflags(_ram[0xc]);
       }
     else
       _index = msg.value & 0x7f;
+    publish();
+    return true;
+  }
+
+
+  /**
+   * Read the data port without taking a lock.  This works only within
+   * the second of the last update cycle and not for the flags
+   * register, as these reads modify the state.
+   */
+  static bool read_fast(Device *dev, MessageIOIn &msg)
+  {
+    Rtc146818 *rtc = static_cast<Rtc146818 *>(dev);
+    if (msg.port != rtc->_iobase + 1 || msg.type != MessageIOIn::TYPE_INB || msg.count)
+      return false;
+
+    Snapshot s;
+    rtc->_seqlock.read(s, rtc->_snapshot);
+    if (s.index == 0xc || (s.ram_a & 0x60) == 0x60) return false;
+
+    timevalue now = get_counter(rtc->_clock, s.ram_a, s.offset);
+    if (!(now < s.next_update && now + FREQ >= s.next_update)) return false;
+    unsigned mod = FREQ - (s.next_update - now);
+    if ((mod >= (FREQ - tUC)) && s.index < 10)  return false;
+
+    msg.value = s.value;
+    if (s.index == 0)   msg.value &= 0x7f;
+    if (s.index == 0xa)
+      {
+	msg.value &= 0x7f;
+	if (~s.ram_b & 0x80 && mod >= (FREQ - tBUC - tUC)) msg.value |= 0x80;
+      }
     return true;
   }
 
@@ -403,7 +551,7 @@ public:
   bool  receive(MessageIrqNotify &msg)
   {
     if (msg.baseirq != (_irq & ~7) || !(msg.mask & (1 << (_irq & 7)))) return false;
-    update_timer(get_ram_time(), get_counter());
+    update_timer(_seconds, get_counter());
     return true;
   }
 
@@ -411,32 +559,41 @@ public:
   bool  receive(MessageTimeout &msg)
   {
     if (msg.nr != _timer) return false;
-    update_cycle(get_counter());
+    timevalue now = get_counter();
+    update_cycle(now);
+    // without an IRQ, there is no notify that rearms the timer
+    if (~_ram[0xc] & 0x80) update_timer(_seconds, now);
+    publish();
     return true;
   }
 
 
-  Rtc146818(DBus<MessageTimer> &bus_timer, DBus<MessageIrqLines> &bus_irqlines, Clock *clock, unsigned timer, unsigned short iobase, unsigned irq)
-    : _bus_timer(bus_timer), _bus_irqlines(bus_irqlines), _clock(clock), _timer(timer), _iobase(iobase), _irq(irq)
-  {}
+  Rtc146818(DBus<MessageTimer> &bus_timer, DBusIrqLines &bus_irqlines, Clock *clock, unsigned short iobase, unsigned irq, unsigned policy)
+    : _bus_timer(bus_timer), _bus_irqlines(bus_irqlines), _clock(clock), _iobase(iobase), _irq(irq), _ticks(policy), _pedge(0), _pedge_tics(0)
+  {
+    MessageTimer msg0(this, receive_static<MessageTimeout>);
+    if (!_bus_timer.send(msg0))
+      Logging::panic("%s can't get a timer", __PRETTY_FUNCTION__);
+    _timer = msg0.nr;
+  }
 };
 
 PARAM_HANDLER(rtc,
-	      "rtc:iobase,irq - Attach a realtime clock including its CMOS RAM.",
-	      "Example: 'rtc:0x70,8'")
+	      "rtc:iobase,irq,policy - Attach a realtime clock including its CMOS RAM.",
+	      "Example: 'rtc:0x70,8'",
+	      "The lost-tick policy of the periodic IRQ is 0=discard, 1=merge (default), 2=delay or 3=catchup.")
 {
-  MessageTimer msg0;
-  if (!mb.bus_timer.send(msg0))
-    Logging::panic("%s can't get a timer", __PRETTY_FUNCTION__);
-
-  Rtc146818 *rtc = new Rtc146818(mb.bus_timer, mb.bus_irqlines, mb.clock(), msg0.nr, argv[0],argv[1]);
+  Rtc146818 *rtc = new Rtc146818(mb.bus_timer, mb.bus_irqlines, mb.clock(), argv[0],argv[1],
+				 ~argv[2] ? argv[2] : unsigned(TickPolicy::MERGE));
   MessageTime msg1;
   if (!mb.bus_time.send(msg1))
     Logging::printf("could not get wallclock time!\n");
   rtc->reset(msg1);
-  mb.bus_ioin.     add(rtc, Rtc146818::receive_static<MessageIOIn>);
-  mb.bus_ioout.    add(rtc, Rtc146818::receive_static<MessageIOOut>);
+  mb.bus_ioin.     add(rtc, Rtc146818::receive_static<MessageIOIn>,  argv[0], 8);
+  mb.bus_ioin.     add_fast(rtc, Rtc146818::read_fast, argv[0] + 1);
+  mb.bus_ioout.    add(rtc, Rtc146818::receive_static<MessageIOOut>, argv[0], 8);
   mb.bus_timeout.  add(rtc, Rtc146818::receive_static<MessageTimeout>);
-  mb.bus_irqnotify.add(rtc, Rtc146818::receive_static<MessageIrqNotify>);
+  if (argv[1] < MessageIrq::LINES)
+    mb.bus_irqnotify.add(rtc, Rtc146818::receive_static<MessageIrqNotify>, argv[1]);
 }
 
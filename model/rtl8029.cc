@@ -24,13 +24,13 @@
  *
  * State: unstable
  * Features: PCI, send, receive, broadcast, promiscuous mode
- * Missing: multicast, CRC calculation, rep optimized
+ * Missing: multicast, CRC calculation
  */
 #ifndef VMM_REGBASE
 class Rtl8029: public StaticReceiver<Rtl8029>
 {
   DBus<MessageNetwork>  &_bus_network;
-  DBus<MessageIrqLines> &_bus_irqlines;
+  DBusIrqLines &_bus_irqlines;
   unsigned char _irq;
   unsigned long long _mac;
   unsigned _bdf;
@@ -266,6 +266,35 @@ class Rtl8029: public StaticReceiver<Rtl8029>
       }
   }
 
+  /**
+   * Remote DMA for a string of count elements.  The transfer is
+   * bounded by the remote byte count and RDC is raised only once.
+   */
+  bool remote_dma(bool read, unsigned order, unsigned &count, void *&ptr)
+  {
+    if (!_regs.rbcr || (_regs.cr & 0x38) != (read ? 0x8 : 0x10)) return false;
+    unsigned len = count << order;
+    if (len > _regs.rbcr) len = _regs.rbcr;
+    if (len > sizeof(_mem) - _regs.rsar) len = sizeof(_mem) - _regs.rsar;
+    len &= ~((1u << order) - 1);
+    if (!len) return false;
+
+    char *p = reinterpret_cast<char *>(ptr);
+    if (read)
+      memcpy(p, _mem + _regs.rsar, len);
+    else {
+      // the first page is read-only
+      unsigned skip = _regs.rsar < 0x100 ? 0x100 - _regs.rsar : 0;
+      if (skip < len) memcpy(_mem + _regs.rsar + skip, p + skip, len - skip);
+    }
+    _regs.rsar += len;
+    _regs.rbcr -= len;
+    count -= len >> order;
+    ptr = p + len;
+    if (!_regs.rbcr)  update_isr(0x40);
+    return true;
+  }
+
   bool match_bar(unsigned long &address) {
     bool res = !((address ^ PCI_BAR) & PCI_BAR_mask);
     address &= ~PCI_BAR_mask;
@@ -284,6 +313,7 @@ public:
     unsigned long addr = msg.port;
     if (!match_bar(addr) || !(PCI_CMD_STS & 0x1))
       return false;
+    if (msg.count) return in_range(addr, 0x10, 8) && remote_dma(true, msg.type, msg.count, msg.ptr);
 
     // for every byte
     for (unsigned i = 0; i < (1u<<msg.type); i++, addr++)
@@ -298,6 +328,7 @@ public:
     unsigned long addr = msg.port;
     if (!match_bar(addr) || !(PCI_CMD_STS & 0x1))
       return false;
+    if (msg.count) return in_range(addr, 0x10, 8) && remote_dma(false, msg.type, msg.count, msg.ptr);
 
     for (unsigned i = 0; i < (1u<<msg.type); i++, addr++)
       write_byte(addr, msg.value >> (i*8));
@@ -307,7 +338,7 @@ public:
   bool receive(MessagePciConfig &msg)  {  return PciHelper::receive(msg, this, _bdf); }
 
 
-  Rtl8029(DBus<MessageNetwork> &bus_network, DBus<MessageIrqLines> &bus_irqlines, unsigned char irq, unsigned long long mac, unsigned bdf) :
+  Rtl8029(DBus<MessageNetwork> &bus_network, DBusIrqLines &bus_irqlines, unsigned char irq, unsigned long long mac, unsigned bdf) :
     _bus_network(bus_network), _bus_irqlines(bus_irqlines),  _irq(irq), _mac(mac), _bdf(bdf)
   {
     PCI_reset();
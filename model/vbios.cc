@@ -27,7 +27,26 @@ public:
 private:
   VCpu *_vcpu;
   unsigned char _resetvector[16];
-  enum {  BIOS_BASE = 0xf0000 };
+  enum {  BIOS_BASE = MessageBios::BIOS_BASE };
+
+  /**
+   * Low memory mapped by the VCPU, to propagate the flags to the
+   * user stack without memory messages.
+   */
+  char     *_lowmem;
+  uintptr_t _lowmem_size;
+
+  unsigned *stack_ptr(uintptr_t address)
+  {
+    if (!_lowmem) {
+      MessageMemRegion msg(0);
+      if (!_vcpu->memregion.send(msg) || !msg.ptr || msg.start_page) return 0;
+      _lowmem      = msg.ptr;
+      _lowmem_size = msg.count << 12;
+    }
+    if (address + sizeof(unsigned) > _lowmem_size) return 0;
+    return reinterpret_cast<unsigned *>(_lowmem + address);
+  }
 
 public:
   bool receive(CpuMessage &msg) {
@@ -35,7 +54,7 @@ public:
 
     CpuState *cpu = msg.cpu;
     if (cpu->pm() && !cpu->v86()
-	|| !in_range(cpu->cs.base + cpu->eip, BIOS_BASE, BiosCommon::MAX_VECTOR)
+	|| !VCpu::in_bios_window(cpu)
 	|| cpu->inj_info & 0x80000000) return false;
 
     COUNTER_INC("VB");
@@ -52,15 +71,29 @@ public:
     msg.mtr_out |= MTD_CS_SS | MTD_RIP_LEN | MTD_RFLAGS;
 
     MessageBios msg1(_vcpu, cpu, irq);
-    if (!_mb.bus_bios.send(msg1, irq != BiosCommon::RESET_VECTOR)) return false;
+
+    // a direct kernel boot skips the whole BIOS reset sequence on the BSP
+    if (irq == BiosCommon::RESET_VECTOR && !_vcpu->get_last()
+        && _mb.bus_bios.send(BiosCommon::DIRECT_BOOT, msg1, true)) {
+      msg.mtr_out |= msg1.mtr_out;
+      return true;
+    }
+
+    if (!_mb.bus_bios.send(irq, msg1, irq != BiosCommon::RESET_VECTOR)) return false;
 
     // we have to propagate the flags to the user stack!
-    unsigned flags;
-    MessageMem msg2(true, cpu->ss.base + cpu->esp + 4, &flags);
-    _vcpu->mem.send(msg2);
-    flags = flags & ~0xffffu | cpu->efl & 0xffffu | flags & 0x200;
-    msg2.read = false;
-    _vcpu->mem.send(msg2);
+    uintptr_t stack = cpu->ss.base + cpu->esp + 4;
+    unsigned *ptr   = stack_ptr(stack);
+    if (ptr)
+      *ptr = *ptr & ~0xffffu | cpu->efl & 0xffffu | *ptr & 0x200;
+    else {
+      unsigned flags;
+      MessageMem msg2(true, stack, &flags);
+      _vcpu->mem.send(msg2);
+      flags = flags & ~0xffffu | cpu->efl & 0xffffu | flags & 0x200;
+      msg2.read = false;
+      _vcpu->mem.send(msg2);
+    }
 
     // we can be sure that we are not blocking irqs
     assert(!cpu->actv_state);
@@ -76,6 +109,7 @@ public:
    */
   bool receive(MessageMem &msg)
   {
+    if (msg.wide()) return false;
     if (!msg.read || !in_range(msg.phys, 0xfffffff0, 0x10) && !in_range(msg.phys, BIOS_BASE + 0xfff0, 0x10))  return false;
     *msg.ptr = *reinterpret_cast<unsigned *>(_resetvector + (msg.phys & 0xc));
     return true;
@@ -86,19 +120,19 @@ public:
     if (msg.type != MessageDiscovery::DISCOVERY) return false;
 
     // initialize realmode idt
-    unsigned value = (BIOS_BASE >> 4) << 16;
-    for (unsigned i=0; i < 256; i++) {
-      // XXX init only whats needed and done on compatible BIOSes
-      if (i != 0x43)
-	discovery_write_dw("realmode idt", i*4, value, 4);
-      value++;
-    }
+    unsigned idt[256];
+    for (unsigned i=0; i < 256; i++)
+      idt[i] = ((BIOS_BASE >> 4) << 16) + i;
+
+    // XXX init only whats needed and done on compatible BIOSes
+    discovery_write_st("realmode idt", 0, idt, 0x43*4);
+    discovery_write_st("realmode idt", 0x44*4, idt + 0x44, (256 - 0x44)*4);
     return true;
   }
 
 
 
-  VBios(Motherboard &mb, VCpu *vcpu) : _mb(mb), _vcpu(vcpu) {
+  VBios(Motherboard &mb, VCpu *vcpu) : _mb(mb), _vcpu(vcpu), _lowmem(), _lowmem_size() {
 
     // initialize the reset vector with noops
     memset(_resetvector, 0x90, sizeof(_resetvector));
@@ -114,9 +148,9 @@ public:
 
     // the iret that is the default operation
     _resetvector[0xf] = 0xcf;
-    _vcpu->executor.add(this,   VBios::receive_static<CpuMessage>);
-    _vcpu->mem.add(this,        VBios::receive_static<MessageMem>);
-    _mb.bus_discovery.add(this, VBios::receive_static<MessageDiscovery>);
+    _vcpu->executor_bios.add(this, VBios::receive_static<CpuMessage>);
+    _vcpu->mem.add(this,           VBios::receive_static<MessageMem>);
+    _mb.bus_discovery.add(this,    VBios::receive_static<MessageDiscovery>);
 
   }
 
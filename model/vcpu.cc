@@ -30,7 +30,6 @@ class VirtualCpu : public VCpu, public StaticReceiver<VirtualCpu>
   Motherboard &_mb;
   long long _reset_tsc_off;
 
-  volatile unsigned _event;
   volatile unsigned _sipi;
 
   unsigned char debugioin[8192];
@@ -87,7 +86,7 @@ class VirtualCpu : public VCpu, public StaticReceiver<VirtualCpu>
 
   void handle_rdtsc(CpuMessage &msg) {
     assert((msg.mtr_in & MTD_TSC) and (msg.mtr_in & MTD_GPR_ACDB));
-    msg.cpu->edx_eax(get_tsc_off(msg) + Cpu::rdtsc());
+    msg.cpu->edx_eax(get_tsc_off(msg) + _mb.clock()->time());
     msg.mtr_out |= MTD_GPR_ACDB;
   }
 
@@ -128,7 +127,7 @@ class VirtualCpu : public VCpu, public StaticReceiver<VirtualCpu>
         {
           long long offset    = get_tsc_off(msg);
 
-          msg.current_tsc_off = - Cpu::rdtsc()        + cpu->edx_eax();
+          msg.current_tsc_off = - _mb.clock()->time() + cpu->edx_eax();
           cpu->tsc_off        =   msg.current_tsc_off - offset;
         }
 	msg.mtr_out |= MTD_TSC;
@@ -284,6 +283,14 @@ class VirtualCpu : public VCpu, public StaticReceiver<VirtualCpu>
   }
 
   void handle_ioin(CpuMessage &msg) {
+    if (msg.io_count) {
+      MessageIOIn msg2(MessageIOIn::Type(msg.io_order), msg.port, msg.io_count, msg.dst);
+      _mb.bus_ioin.send(msg2, true);
+      msg.io_count = msg2.count;
+      msg.dst      = msg2.ptr;
+      return;
+    }
+
     MessageIOIn msg2(MessageIOIn::Type(msg.io_order), msg.port);
     bool res = _mb.bus_ioin.send(msg2);
 
@@ -298,6 +305,14 @@ class VirtualCpu : public VCpu, public StaticReceiver<VirtualCpu>
 
 
   void handle_ioout(CpuMessage &msg) {
+    if (msg.io_count) {
+      MessageIOOut msg2(MessageIOOut::Type(msg.io_order), msg.port, msg.io_count, msg.dst);
+      _mb.bus_ioout.send(msg2, true);
+      msg.io_count = msg2.count;
+      msg.dst      = msg2.ptr;
+      return;
+    }
+
     MessageIOOut msg2(MessageIOOut::Type(msg.io_order), msg.port, 0);
     Cpu::move(&msg2.value, msg.dst, msg.io_order);
 
@@ -461,11 +476,11 @@ public:
     return true;
   }
 
-  VirtualCpu(VCpu *_last, Motherboard &mb) : VCpu(_last), _mb(mb), _event(0), _sipi(~0u) {
+  VirtualCpu(VCpu *_last, Motherboard &mb) : VCpu(_last), _mb(mb), _sipi(~0u) {
     MessageHostOp msg(this);
     if (!mb.bus_hostop.send(msg)) Logging::panic("could not create VCpu backend.");
     _hostop_id = msg.value;
-    _reset_tsc_off = -Cpu::rdtsc();
+    _reset_tsc_off = -mb.clock()->time();
 
     // add to the busses
     executor. add(this, VirtualCpu::receive_static<CpuMessage>);
@@ -365,6 +365,7 @@ public:
 
   bool  receive(MessageIOOut &msg)
   {
+    if (msg.count) return false;
     bool res = false;
     for (unsigned i = 0; i < (1u << msg.type); i++)
       {
@@ -420,6 +421,7 @@ public:
 
   bool  receive(MessageIOIn &msg)
   {
+    if (msg.count) return false;
     bool res = false;;
     for (unsigned i = 0; i < (1u << msg.type); i++)
       {
@@ -470,14 +472,14 @@ public:
 
   bool  receive(MessageMem &msg)
   {
-    unsigned *ptr;
-    if (in_range(msg.phys, _framebuffer_phys, _framebuffer_size))
-      ptr = reinterpret_cast<unsigned *>(_framebuffer_ptr + msg.phys - _framebuffer_phys);
-    else if (in_range(msg.phys, LOW_BASE, LOW_SIZE))
-      ptr = reinterpret_cast<unsigned *>(_framebuffer_ptr + msg.phys - LOW_BASE);
+    char *ptr;
+    if (in_range(msg.phys, _framebuffer_phys, _framebuffer_size - msg.len + 1))
+      ptr = _framebuffer_ptr + msg.phys - _framebuffer_phys;
+    else if (in_range(msg.phys, LOW_BASE, LOW_SIZE - msg.len + 1))
+      ptr = _framebuffer_ptr + msg.phys - LOW_BASE;
     else return false;
 
-    if (msg.read) *msg.ptr = *ptr; else *ptr = *msg.ptr;
+    if (msg.read) memcpy(msg.ptr, ptr, msg.len); else memcpy(ptr, msg.ptr, msg.len);
     return true;
   }
 
@@ -570,9 +572,10 @@ PARAM_HANDLER(vga,
     Logging::panic("%s failed to alloc %zd from guest memory\n", __PRETTY_FUNCTION__, fbsize);
 
   Vga *dev = new Vga(mb, argv[0], msg2.ptr + msg.phys, msg.phys, fbsize);
-  mb.bus_ioin     .add(dev, Vga::receive_static<MessageIOIn>);
-  mb.bus_ioout    .add(dev, Vga::receive_static<MessageIOOut>);
-  mb.bus_bios     .add(dev, Vga::receive_static<MessageBios>);
+  // wide accesses below the iobase reach our registers as well
+  mb.bus_ioin     .add(dev, Vga::receive_static<MessageIOIn>,  argv[0] - 3, 32 + 3);
+  mb.bus_ioout    .add(dev, Vga::receive_static<MessageIOOut>, argv[0] - 3, 32 + 3);
+  mb.bus_bios     .add(dev, Vga::receive_static<MessageBios>, 0x10, Vga::RESET_VECTOR);
   mb.bus_mem      .add(dev, Vga::receive_static<MessageMem>);
   mb.bus_memregion.add(dev, Vga::receive_static<MessageMemRegion>);
   mb.bus_discovery.add(dev, Vga::receive_static<MessageDiscovery>);
@@ -247,6 +247,18 @@ bool Vancouver::receive(MessageHostOp &msg) {
         }
         break;
 
+        case MessageHostOp::OP_REVOKE_MEMREGION: {
+            // the guest mappings were delegated from our own pages
+            CapRange(reinterpret_cast<uintptr_t>(msg.ptr) >> ExecEnv::PAGE_SHIFT,
+                     msg.len >> ExecEnv::PAGE_SHIFT, Crd::MEM_ALL).revoke(false);
+            for(::VCpu *vcpu = _mb.last_vcpu; vcpu; vcpu = vcpu->get_last()) {
+                CpuMessage cmsg(CpuMessage::TYPE_REVOKE_MEMREGION, nullptr, 0);
+                vcpu->executor.send(cmsg);
+            }
+            res = true;
+        }
+        break;
+
         case MessageHostOp::OP_ALLOC_SERVICE_THREAD: {
             assert(false);
             /* TODO
@@ -0,0 +1,231 @@
+/**
+ * AF_PACKET network backend
+ *
+ * Economic rights: Technische Universitaet Dresden (Germany)
+ *
+ * This file is part of Seoul.
+ *
+ * Seoul is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Seoul is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#include <nul/motherboard.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+#include <seoul/unix.h>
+
+/**
+ * Connects bus_network to a host interface with TPACKET_V3 rings.
+ *
+ * The receive ring is consumed a block at a time and its frames go
+ * to the network models without being copied.  Sent frames are
+ * queued in the transmit ring and handed to the kernel by a
+ * dedicated thread, so that frames queued while it is busy share a
+ * single sendto.
+ */
+class AfPacketNetwork : public StaticReceiver<AfPacketNetwork>
+{
+  enum {
+    BLOCK_SIZE = 1 << 16,
+    FRAME_SIZE = 1 << 11,
+    RX_BLOCKS  = 64,
+    TX_BLOCKS  = 16,
+    TX_FRAMES  = TX_BLOCKS * (BLOCK_SIZE / FRAME_SIZE),
+    TX_DATA    = TPACKET_ALIGN(sizeof(struct tpacket3_hdr)),
+    RETIRE_MS  = 1,
+  };
+
+  DBus<MessageNetwork> &_bus_network;
+  int            _fd;
+  unsigned char *_rx_ring;
+  unsigned char *_tx_ring;
+  unsigned       _rx_block;
+  unsigned       _tx_frame;
+  unsigned       _tx_kick;
+  unsigned       _tx_dropped;
+  sem_t          _tx_sem;
+
+  bool own_packet(const unsigned char *buffer)
+  {
+    return buffer >= _rx_ring && buffer < _rx_ring + RX_BLOCKS * BLOCK_SIZE;
+  }
+
+  /**
+   * Hand all frames of a retired block to the models.
+   */
+  void deliver_block(struct tpacket_block_desc *block)
+  {
+    struct tpacket3_hdr *hdr = reinterpret_cast<struct tpacket3_hdr *>
+      (reinterpret_cast<unsigned char *>(block) + block->hdr.bh1.offset_to_first_pkt);
+
+    pthread_mutex_lock(&irq_mtx);
+    for (unsigned i = 0; i < block->hdr.bh1.num_pkts; i++) {
+      struct sockaddr_ll *sll = reinterpret_cast<struct sockaddr_ll *>
+        (reinterpret_cast<unsigned char *>(hdr) + TPACKET_ALIGN(sizeof(*hdr)));
+
+      // frames the host sends out of this interface are not for us
+      if (sll->sll_pkttype != PACKET_OUTGOING) {
+        MessageNetwork msg(reinterpret_cast<unsigned char *>(hdr) + hdr->tp_mac, hdr->tp_snaplen, 0);
+        _bus_network.send(msg);
+      }
+      hdr = reinterpret_cast<struct tpacket3_hdr *>(reinterpret_cast<unsigned char *>(hdr) + hdr->tp_next_offset);
+    }
+    pthread_mutex_unlock(&irq_mtx);
+  }
+
+public:
+
+  bool receive(MessageNetwork &msg)
+  {
+    if (msg.type != MessageNetwork::PACKET || own_packet(msg.buffer)) return false;
+
+    struct tpacket3_hdr *hdr = reinterpret_cast<struct tpacket3_hdr *>(_tx_ring + _tx_frame * FRAME_SIZE);
+    if (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) & (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING)
+        || msg.len > FRAME_SIZE - TX_DATA) {
+      if (!(_tx_dropped++ & 0xff)) Logging::printf("afpacket: dropped %u packets\n", _tx_dropped);
+      return false;
+    }
+
+    memcpy(reinterpret_cast<unsigned char *>(hdr) + TX_DATA, msg.buffer, msg.len);
+    hdr->tp_len        = msg.len;
+    hdr->tp_snaplen    = msg.len;
+    hdr->tp_next_offset = 0;
+    __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+    _tx_frame = (_tx_frame + 1) % TX_FRAMES;
+
+    // wake the transmit thread, unless a kick is already pending
+    if (!__atomic_exchange_n(&_tx_kick, 1, __ATOMIC_ACQ_REL)) sem_post(&_tx_sem);
+    return true;
+  }
+
+
+  static void *rx_thread_fn(void *arg)
+  {
+    AfPacketNetwork *n = reinterpret_cast<AfPacketNetwork *>(arg);
+    struct pollfd pfd = { n->_fd, POLLIN | POLLERR, 0 };
+
+    while (true) {
+      struct tpacket_block_desc *block = reinterpret_cast<struct tpacket_block_desc *>
+        (n->_rx_ring + n->_rx_block * BLOCK_SIZE);
+
+      if (!(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+        if (poll(&pfd, 1, -1) < 0) { perror("afpacket: poll"); break; }
+        continue;
+      }
+
+      n->deliver_block(block);
+      __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+      n->_rx_block = (n->_rx_block + 1) % RX_BLOCKS;
+    }
+    return nullptr;
+  }
+
+
+  static void *tx_thread_fn(void *arg)
+  {
+    AfPacketNetwork *n = reinterpret_cast<AfPacketNetwork *>(arg);
+
+    while (true) {
+      sem_wait(&n->_tx_sem);
+      __atomic_store_n(&n->_tx_kick, 0, __ATOMIC_RELEASE);
+      if (sendto(n->_fd, nullptr, 0, 0, nullptr, 0) < 0) perror("afpacket: sendto");
+    }
+    return nullptr;
+  }
+
+
+  /**
+   * Bind to the interface and map both rings.
+   */
+  bool open(const char *ifname, size_t len)
+  {
+    char name[IF_NAMESIZE];
+    if (len >= sizeof(name)) return false;
+    memcpy(name, ifname, len);
+    name[len] = 0;
+
+    struct tpacket_req3 rx, tx;
+    memset(&rx, 0, sizeof(rx));
+    rx.tp_block_size = BLOCK_SIZE;
+    rx.tp_block_nr   = RX_BLOCKS;
+    rx.tp_frame_size = FRAME_SIZE;
+    rx.tp_frame_nr   = RX_BLOCKS * (BLOCK_SIZE / FRAME_SIZE);
+    rx.tp_retire_blk_tov = RETIRE_MS;
+    memset(&tx, 0, sizeof(tx));
+    tx.tp_block_size = BLOCK_SIZE;
+    tx.tp_block_nr   = TX_BLOCKS;
+    tx.tp_frame_size = FRAME_SIZE;
+    tx.tp_frame_nr   = TX_FRAMES;
+
+    int version = TPACKET_V3;
+    struct sockaddr_ll sll;
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family   = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex  = if_nametoindex(name);
+
+    _fd = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, htons(ETH_P_ALL));
+    if (_fd < 0 || !sll.sll_ifindex
+        || setsockopt(_fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version))
+        || setsockopt(_fd, SOL_PACKET, PACKET_RX_RING, &rx, sizeof(rx))
+        || setsockopt(_fd, SOL_PACKET, PACKET_TX_RING, &tx, sizeof(tx))) {
+      perror("afpacket: setup");
+      return false;
+    }
+
+    void *ptr = mmap(nullptr, (RX_BLOCKS + TX_BLOCKS) * BLOCK_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, _fd, 0);
+    if (ptr == MAP_FAILED) { perror("afpacket: mmap"); return false; }
+    _rx_ring = reinterpret_cast<unsigned char *>(ptr);
+    _tx_ring = _rx_ring + RX_BLOCKS * BLOCK_SIZE;
+
+    if (bind(_fd, reinterpret_cast<struct sockaddr *>(&sll), sizeof(sll))) {
+      perror("afpacket: bind");
+      return false;
+    }
+    return true;
+  }
+
+  AfPacketNetwork(DBus<MessageNetwork> &bus_network)
+    : _bus_network(bus_network), _fd(-1), _rx_ring(), _tx_ring(), _rx_block(), _tx_frame(), _tx_kick(), _tx_dropped()
+  {
+    sem_init(&_tx_sem, 0, 0);
+  }
+};
+
+
+PARAM_HANDLER(afpacket,
+              "afpacket:ifname - connect the network to a host interface using mmapped AF_PACKET rings.")
+{
+  AfPacketNetwork *n = new AfPacketNetwork(mb.bus_network);
+  if (!n->open(args, args_len)) Logging::panic("afpacket: could not attach to '%.*s'\n", int(args_len), args);
+
+  mb.bus_network.add(n, AfPacketNetwork::receive_static<MessageNetwork>);
+
+  pthread_t rx, tx;
+  if (pthread_create(&rx, NULL, AfPacketNetwork::rx_thread_fn, n)
+      || pthread_create(&tx, NULL, AfPacketNetwork::tx_thread_fn, n))
+    Logging::panic("afpacket: could not create threads\n");
+  pthread_setname_np(rx, "afpacket-rx");
+  pthread_setname_np(tx, "afpacket-tx");
+  place_thread(rx, "afpacket-rx", "io");
+  place_thread(tx, "afpacket-tx", "io");
+}
+
+// EOF
@@ -0,0 +1,194 @@
+/** -*- Mode: C++ -*-
+ * Shared-memory packet rings between Seoul and a packet switch.
+ *
+ * Economic rights: Technische Universitaet Dresden (Germany)
+ *
+ * This file is part of Seoul.
+ *
+ * Seoul is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Seoul is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#pragma once
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+/**
+ * A single-producer single-consumer ring of packet slots.
+ *
+ * The producer owns head and the slot lengths, the consumer owns tail
+ * and sleeping; each lives on its own cache line.  A consumer that runs out of packets sets sleeping
+ * and waits on its eventfd.  The producer only kicks a sleeping
+ * consumer, so a busy consumer never costs a syscall.
+ */
+struct ShmPacketRing
+{
+  enum {
+    SLOTS     = 256,
+    SLOT_SIZE = 2048,
+    MAX_PACKET= SLOT_SIZE - 8,
+  };
+
+  struct Slot {
+    unsigned      len;
+    unsigned      res;
+    unsigned char data[MAX_PACKET];
+  };
+
+  unsigned head     __attribute__((aligned(64)));
+  unsigned tail     __attribute__((aligned(64)));
+  unsigned sleeping __attribute__((aligned(64)));
+  Slot     slots[SLOTS] __attribute__((aligned(64)));
+
+  void init() { head = tail = 0; sleeping = 1; }
+
+  /**
+   * Producer: a free slot or null if the ring is full.
+   */
+  Slot *produce_slot()
+  {
+    if (head - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) >= SLOTS) return 0;
+    return slots + (head % SLOTS);
+  }
+
+  /**
+   * Producer: publish the slot returned by produce_slot().
+   */
+  void produce(unsigned len)
+  {
+    slots[head % SLOTS].len = len;
+    __atomic_store_n(&head, head + 1, __ATOMIC_RELEASE);
+  }
+
+  /**
+   * Producer: does the consumer wait for a kick?
+   */
+  bool need_kick()
+  {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return __atomic_load_n(&sleeping, __ATOMIC_RELAXED);
+  }
+
+  /**
+   * Consumer: the oldest packet or null if the ring is empty.  The
+   * length is read only once, as the peer may change it anytime.
+   */
+  Slot *peek(unsigned &len)
+  {
+    if (tail == __atomic_load_n(&head, __ATOMIC_ACQUIRE)) return 0;
+    Slot *s = slots + (tail % SLOTS);
+    len = __atomic_load_n(&s->len, __ATOMIC_RELAXED);
+    if (len > MAX_PACKET) len = MAX_PACKET;
+    return s;
+  }
+
+  /**
+   * Consumer: release the slot returned by peek().
+   */
+  void consume() { __atomic_store_n(&tail, tail + 1, __ATOMIC_RELEASE); }
+
+  /**
+   * Consumer: announce that we go to sleep.  Returns false if a
+   * packet arrived in the meantime and we should keep polling.
+   */
+  bool prepare_sleep()
+  {
+    __atomic_store_n(&sleeping, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (tail == __atomic_load_n(&head, __ATOMIC_ACQUIRE)) return true;
+    __atomic_store_n(&sleeping, 0, __ATOMIC_RELAXED);
+    return false;
+  }
+
+  void wakeup() { __atomic_store_n(&sleeping, 0, __ATOMIC_RELAXED); }
+};
+
+
+/**
+ * The shared region.  It is created by the Seoul side and handed to
+ * the switch over its UNIX socket.
+ */
+struct ShmNetRegion
+{
+  enum {
+    MAGIC   = 0x6c756f53, // "Soul"
+    VERSION = 2,
+  };
+
+  unsigned      magic;
+  unsigned      version;
+  ShmPacketRing to_switch;
+  ShmPacketRing from_switch;
+};
+
+
+/**
+ * The handshake.  The message carries the region memfd, the eventfd
+ * that kicks the switch and the eventfd that kicks Seoul as
+ * SCM_RIGHTS, in that order.
+ */
+struct ShmNetHello
+{
+  enum { FDS = 3 };
+  unsigned magic;
+  unsigned version;
+  unsigned long long size;
+
+  /**
+   * Send the hello and our file descriptors.  Returns false on error.
+   */
+  bool send(int sock, const int (&fds)[FDS])
+  {
+    char   control[CMSG_SPACE(sizeof(fds))];
+    struct iovec  iov = { this, sizeof(*this) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_RIGHTS;
+    cmsg->cmsg_len   = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    return sendmsg(sock, &msg, 0) == sizeof(*this);
+  }
+
+  /**
+   * Receive a hello and its file descriptors.  Returns false on error.
+   */
+  bool recv(int sock, int (&fds)[FDS])
+  {
+    char   control[CMSG_SPACE(sizeof(fds))];
+    struct iovec  iov = { this, sizeof(*this) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof(control);
+
+    if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != sizeof(*this)) return false;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS
+        || cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))
+      return false;
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    return magic == ShmNetRegion::MAGIC && version == ShmNetRegion::VERSION
+      && size == sizeof(ShmNetRegion);
+  }
+};
+
+// EOF
@@ -24,4 +24,8 @@
 // everything else.
 extern pthread_mutex_t irq_mtx;
 
+// Pin a thread and set its scheduling policy as configured for its
+// role, e.g. "vcpu1", or otherwise its class, e.g. "vcpu".
+void place_thread(pthread_t tid, const char *role, const char *cls);
+
 // EOF
@@ -28,15 +28,19 @@
 #include <nul/vcpu.h>
 #include <service/profile.h>
 #include <host/dma.h>
+#include <model/config.h>
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sched.h>
 #include <sys/mman.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/select.h>
+#include <sys/uio.h>
+#include <limits.h>
 #include <time.h>
 #include <signal.h>
 #include <fcntl.h>
@@ -46,6 +50,8 @@
 #include <semaphore.h>
 
 #include <vector>
+#include <string>
+#include <map>
 
 #include <seoul/unix.h>
 
@@ -57,7 +63,10 @@ const char version_str[] =
 
 static char  *ram;
 static size_t ram_size = 128 << 20; // 128 MB
+static size_t ram_mapped;           // ram_size before OP_ALLOC_FROM_GUEST took anything
 static int    tap_fd;               // TAP device. If 0, network packets go to /dev/null.
+static bool   virtual_time;         // Skip ahead in time when all vCPUs are idle.
+static bool   lock_memory;          // Lock all memory with mlockall.
 
 static const char *pc_ps2[] = {
   // Unix backend
@@ -93,7 +102,14 @@ static const char *pc_ps2[] = {
 
 // Globals
 
-static TimeoutList<32, void> timeouts;
+// The receiver of the timeouts of a timer with an owner.
+struct TimerOwner {
+  Device *dev;
+  bool  (*func)(Device *, MessageTimeout &);
+};
+
+enum { MAX_TIMERS = 32 };
+static TimeoutList<MAX_TIMERS, TimerOwner> timeouts;
 static timevalue             last_to = ~0ULL;
 static timer_t               timer_id;
 
@@ -138,34 +154,417 @@ static std::vector<Module> modules;
 
 // Disk data
 
+// Bounce buffers for O_DIRECT requests with unaligned guest buffers.
+// They are used together, so that a request needs few syscalls.  An
+// extra sector buffer at the end holds the last sector of a write
+// that does not end on a sector boundary.
+enum {
+  BOUNCE_BUFFERS = 8,
+  BOUNCE_SIZE    = 128 << 10,
+  BOUNCE_ALIGN   = 4096,
+};
+static char *bounce_pool;
+
 struct Disk {
+  enum Cache {
+    CACHE_WRITEBACK,    // host page cache, flushed on request
+    CACHE_WRITETHROUGH, // host page cache, every write is synchronous
+    CACHE_DIRECT,       // O_DIRECT, bypasses the host page cache
+  };
+
   const char *name;
   int         fd;
   size_t      size;
+  Cache       cache;
+  size_t      mem_align; // buffer alignment needed with O_DIRECT
+
+  // The data extents of the image as start -> end.  Everything else
+  // is a hole and reads as zero.  We assume that nobody else writes
+  // to the image while we run.
+  std::map<off_t, off_t> extents;
+
+  /**
+   * Build the extent map.  Without SEEK_DATA support, the whole
+   * image counts as data.
+   */
+  void scan_extents(off_t file_size)
+  {
+    off_t pos = 0;
+    while (pos < file_size) {
+      off_t start = lseek(fd, pos, SEEK_DATA);
+      if (start < 0) {
+        if (errno == ENXIO) break; // only holes left
+        extents.clear();
+        extents[0] = size;
+        return;
+      }
+      off_t end = lseek(fd, start, SEEK_HOLE);
+      if (end < 0) end = file_size;
+      extents[start] = end;
+      pos = end;
+    }
+  }
 
-  static Disk from_file(const char *filename)
+  bool is_hole(off_t start, off_t end) const
   {
+    auto it = extents.lower_bound(end);
+    return it == extents.begin() or (--it)->second <= start;
+  }
+
+  /**
+   * A write makes the range data, merging it with its neighbours.
+   */
+  void mark_data(off_t start, off_t end)
+  {
+    auto it = extents.upper_bound(start);
+    if (it != extents.begin() and std::prev(it)->second >= start) {
+      --it;
+      start = it->first;
+    }
+    while (it != extents.end() and it->first <= end) {
+      end = std::max(end, it->second);
+      it = extents.erase(it);
+    }
+    extents[start] = end;
+  }
+
+  static bool parse_cache(const char *s, Cache &cache)
+  {
+    if      (!strcmp(s, "writeback"))    cache = CACHE_WRITEBACK;
+    else if (!strcmp(s, "writethrough")) cache = CACHE_WRITETHROUGH;
+    else if (!strcmp(s, "direct"))       cache = CACHE_DIRECT;
+    else return false;
+    return true;
+  }
+
+  /**
+   * Does the file system support O_DIRECT with sector offsets?
+   */
+  bool probe_direct()
+  {
+    mem_align = 512;
+#ifdef STATX_DIOALIGN
+    struct statx stx;
+    if (0 == statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) and stx.stx_mask & STATX_DIOALIGN) {
+      if (!stx.stx_dio_offset_align or stx.stx_dio_offset_align > 512) return false;
+      mem_align = stx.stx_dio_mem_align;
+    }
+#endif
+    return true;
+  }
+
+  static Disk from_file(const char *filename, Cache cache)
+  {
+    static const int   flags[] = { 0, O_DSYNC, O_DIRECT };
+    static const char *names[] = { "writeback", "writethrough", "direct" };
     Disk d;
     struct stat st;
 
-    d.name = filename;
-    if (0  > (d.fd = open(filename, O_RDWR)) or
+    d.name  = filename;
+    d.cache = cache;
+    d.mem_align = 512;
+    d.fd    = open(filename, O_RDWR | flags[cache]);
+    if (0 <= d.fd and cache == CACHE_DIRECT and !d.probe_direct()) {
+      close(d.fd);
+      d.fd = -1;
+      errno = EINVAL;
+    }
+    if (0 > d.fd and errno == EINVAL and cache == CACHE_DIRECT) {
+      fprintf(stderr, "'%s' does not support direct I/O, using writeback.\n", filename);
+      d.cache = CACHE_WRITEBACK;
+      d.fd    = open(filename, O_RDWR);
+    }
+    if (0  > d.fd or
         0 != fstat(d.fd, &st)) {
       perror("open disk"); exit(EXIT_FAILURE);
     }
 
+    if (d.cache == CACHE_DIRECT and !bounce_pool and
+        posix_memalign(reinterpret_cast<void **>(&bounce_pool), BOUNCE_ALIGN, BOUNCE_BUFFERS * BOUNCE_SIZE + BOUNCE_ALIGN)) {
+      perror("bounce buffers"); exit(EXIT_FAILURE);
+    }
+
     d.size = (st.st_size + 511) & ~511; // Round to sector size
+    d.scan_extents(st.st_size);
 
-    printf("Added '%s' (%zu bytes) as disk.\n", filename, d.size);
+    size_t data = 0;
+    for (auto &e : d.extents) data += e.second - e.first;
+    printf("Added '%s' (%zu bytes, %zu allocated, %s) as disk.\n", filename, d.size, data, names[d.cache]);
     return d;
   }
 };
 
 static std::vector<Disk> disks;
 
+// Copy between a flat buffer and the iovecs, starting skip bytes into them.
+static void iov_copy(const struct iovec *iov, unsigned count, size_t skip, char *buf, size_t len, bool to_iov)
+{
+  for (unsigned i = 0; i < count and len; i++) {
+    if (skip >= iov[i].iov_len) {
+      skip -= iov[i].iov_len;
+      continue;
+    }
+    char  *p = reinterpret_cast<char *>(iov[i].iov_base) + skip;
+    size_t n = std::min(iov[i].iov_len - skip, len);
+    if (to_iov) memcpy(p, buf, n); else memcpy(buf, p, n);
+    buf += n;
+    len -= n;
+    skip = 0;
+  }
+}
+
+// Zero the iovecs, starting skip bytes into them.
+static void iov_zero(const struct iovec *iov, unsigned count, size_t skip)
+{
+  for (unsigned i = 0; i < count; i++) {
+    if (skip >= iov[i].iov_len) {
+      skip -= iov[i].iov_len;
+      continue;
+    }
+    memset(reinterpret_cast<char *>(iov[i].iov_base) + skip, 0, iov[i].iov_len - skip);
+    skip = 0;
+  }
+}
+
+/**
+ * Transfer between a disk and the iovecs. With O_DIRECT, requests
+ * with unaligned guest buffers go through the bounce buffers.
+ */
+static ssize_t disk_io(Disk &disk, bool read, const struct iovec *iov, unsigned count, off_t offset)
+{
+  if (disk.cache != Disk::CACHE_DIRECT)
+    return read ? preadv(disk.fd, iov, count, offset) : pwritev(disk.fd, iov, count, offset);
+
+  bool aligned = true;
+  size_t total = 0;
+  for (unsigned i = 0; i < count; i++) {
+    aligned = aligned and !(reinterpret_cast<uintptr_t>(iov[i].iov_base) & (disk.mem_align - 1))
+      and !(iov[i].iov_len & 511);
+    total += iov[i].iov_len;
+  }
+
+  if (aligned)
+    return read ? preadv(disk.fd, iov, count, offset) : pwritev(disk.fd, iov, count, offset);
+
+  COUNTER_INC("disk bounced");
+  size_t done = 0;
+  while (done < total) {
+    size_t chunk = std::min(total - done, size_t(BOUNCE_BUFFERS * BOUNCE_SIZE));
+
+    // O_DIRECT needs whole sectors.  The rest of a partial last sector
+    // is not copied on reads and is kept from the disk on writes.
+    size_t io_len = (chunk + 511) & ~511ul;
+    if (!read and io_len != chunk) {
+      char   *tail = bounce_pool + BOUNCE_BUFFERS * BOUNCE_SIZE;
+      ssize_t res  = pread(disk.fd, tail, 512, offset + done + io_len - 512);
+      if (res < 0) return done ? ssize_t(done) : res;
+      memset(tail + res, 0, 512 - res);
+      memcpy(bounce_pool + io_len - 512, tail, 512);
+    }
+    struct iovec bounce[BOUNCE_BUFFERS];
+    unsigned n;
+    for (n = 0; n * BOUNCE_SIZE < io_len; n++) {
+      bounce[n].iov_base = bounce_pool + n * BOUNCE_SIZE;
+      bounce[n].iov_len  = std::min(io_len - n * BOUNCE_SIZE, size_t(BOUNCE_SIZE));
+    }
+
+    if (!read) iov_copy(iov, count, done, bounce_pool, chunk, false);
+    ssize_t res = read ? preadv(disk.fd, bounce, n, offset + done) : pwritev(disk.fd, bounce, n, offset + done);
+    if (res <= 0) return done ? ssize_t(done) : res;
+    if (size_t(res) < chunk) chunk = res;
+    if (read) iov_copy(iov, count, done, bounce_pool, chunk, true);
+
+    done += chunk;
+    if (size_t(res) < io_len) break;
+  }
+  return done;
+}
+
 // Used to serialize all operations (for now).
 pthread_mutex_t irq_mtx;
 
+// Thread placement
+
+struct Placement {
+  std::string role;
+  cpu_set_t   cpus;     // empty if not pinned
+  int         prio;     // SCHED_FIFO priority, 0 keeps the default policy
+};
+
+static std::vector<Placement> placements;
+static std::vector<std::pair<pthread_t, std::string> > placed_threads;
+static pthread_attr_t         timer_attr;
+
+static Placement &placement(const std::string &role)
+{
+  for (Placement &p : placements)
+    if (p.role == role) return p;
+
+  placements.push_back(Placement());
+  Placement &p = placements.back();
+  p.role = role;
+  p.prio = 0;
+  CPU_ZERO(&p.cpus);
+  return p;
+}
+
+/**
+ * The placement of a thread is the one of its role, e.g. vcpu1, or
+ * otherwise the one of its class, e.g. vcpu.
+ */
+static const Placement *lookup_placement(const std::string &role, const std::string &cls)
+{
+  const Placement *res = nullptr;
+  for (const Placement &p : placements) {
+    if (p.role == role) return &p;
+    if (p.role == cls)  res = &p;
+  }
+  return res;
+}
+
+// Parse a CPU list like "0-3,6".
+static bool parse_cpulist(const char *s, cpu_set_t &set)
+{
+  CPU_ZERO(&set);
+  while (*s) {
+    char *end;
+    unsigned long first = strtoul(s, &end, 10);
+    unsigned long last  = first;
+    if (end == s) return false;
+    if (*end == '-') {
+      s    = end + 1;
+      last = strtoul(s, &end, 10);
+      if (end == s) return false;
+    }
+    if (last < first or last >= CPU_SETSIZE) return false;
+    for (unsigned long i = first; i <= last; i++) CPU_SET(i, &set);
+
+    s = end;
+    if (*s == ',') s++;
+    else if (*s)   return false;
+  }
+  return CPU_COUNT(&set) > 0;
+}
+
+static std::string format_cpulist(const cpu_set_t &set)
+{
+  std::string res;
+  for (unsigned i = 0; i < CPU_SETSIZE; i++) {
+    if (!CPU_ISSET(i, &set)) continue;
+    unsigned last = i;
+    while (last + 1 < CPU_SETSIZE and CPU_ISSET(last + 1, &set)) last++;
+
+    char buf[32];
+    snprintf(buf, sizeof(buf), last == i ? "%s%u" : "%s%u-%u", res.empty() ? "" : ",", i, last);
+    res += buf;
+    i = last;
+  }
+  return res;
+}
+
+// Parse "role=cpulist" or "role=priority".
+static bool parse_placement(const char *arg, bool priority)
+{
+  const char *eq = strchr(arg, '=');
+  if (!eq or eq == arg) return false;
+  Placement &p = placement(std::string(arg, eq - arg));
+
+  if (!priority) return parse_cpulist(eq + 1, p.cpus);
+
+  char *end;
+  long prio = strtol(eq + 1, &end, 10);
+  if (*end or prio < sched_get_priority_min(SCHED_FIFO) or prio > sched_get_priority_max(SCHED_FIFO))
+    return false;
+  p.prio = prio;
+  return true;
+}
+
+void place_thread(pthread_t tid, const char *role, const char *cls)
+{
+  placed_threads.push_back(std::make_pair(tid, std::string(role)));
+  const Placement *p = lookup_placement(role, cls);
+  if (!p) return;
+
+  // Failures are not fatal: SCHED_FIFO usually needs privileges.
+  int err;
+  if (CPU_COUNT(&p->cpus) and (err = pthread_setaffinity_np(tid, sizeof(p->cpus), &p->cpus)))
+    fprintf(stderr, "%s: could not set affinity: %s\n", role, strerror(err));
+  if (p->prio) {
+    struct sched_param param;
+    param.sched_priority = p->prio;
+    if ((err = pthread_setschedparam(tid, SCHED_FIFO, &param)))
+      fprintf(stderr, "%s: could not set SCHED_FIFO: %s\n", role, strerror(err));
+  }
+}
+
+static void *probe_thread_fn(void *) { return nullptr; }
+
+/**
+ * The timer thread is created by the C library for every timeout,
+ * thus its placement is passed as thread attributes.
+ */
+static void init_timer_attr()
+{
+  pthread_attr_init(&timer_attr);
+  const Placement *p = lookup_placement("timer", "timer");
+  if (!p) return;
+
+  if (CPU_COUNT(&p->cpus))
+    pthread_attr_setaffinity_np(&timer_attr, sizeof(p->cpus), &p->cpus);
+  if (p->prio) {
+    struct sched_param param;
+    param.sched_priority = p->prio;
+    pthread_attr_setinheritsched(&timer_attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&timer_attr, SCHED_FIFO);
+    pthread_attr_setschedparam(&timer_attr, &param);
+  }
+
+  // A timer thread that cannot be created would silently drop all
+  // timeouts. Thus check the attributes once.
+  pthread_t probe;
+  int err = pthread_create(&probe, &timer_attr, probe_thread_fn, nullptr);
+  if (err) {
+    fprintf(stderr, "timer: could not apply placement: %s\n", strerror(err));
+    pthread_attr_destroy(&timer_attr);
+    pthread_attr_init(&timer_attr);
+  } else
+    pthread_join(probe, nullptr);
+}
+
+static void report_placement()
+{
+  printf("Thread placement:\n");
+  for (auto &t : placed_threads) {
+    cpu_set_t set;
+    int policy;
+    struct sched_param param;
+    if (pthread_getaffinity_np(t.first, sizeof(set), &set) or
+        pthread_getschedparam(t.first, &policy, &param))
+      continue;
+    printf("  %-12s cpus %-12s %s %d\n", t.second.c_str(), format_cpulist(set).c_str(),
+           policy == SCHED_FIFO ? "fifo" : "other", param.sched_priority);
+  }
+
+  cpu_set_t set;
+  int inherit, policy;
+  struct sched_param param;
+  pthread_attr_getinheritsched(&timer_attr, &inherit);
+  pthread_attr_getschedpolicy(&timer_attr, &policy);
+  pthread_attr_getschedparam(&timer_attr, &param);
+  if (pthread_attr_getaffinity_np(&timer_attr, sizeof(set), &set) or !CPU_COUNT(&set))
+    printf("  %-12s cpus %-12s", "timer", "any");
+  else
+    printf("  %-12s cpus %-12s", "timer", format_cpulist(set).c_str());
+  if (inherit == PTHREAD_EXPLICIT_SCHED and policy == SCHED_FIFO)
+    printf(" fifo %d\n", param.sched_priority);
+  else
+    printf(" inherited\n");
+
+  printf("  memory %s\n", lock_memory ? "locked" : "not locked");
+}
+
+static void disk_flush();
+
 static void skip_instruction(CpuMessage &msg)
 {
   // advance EIP
@@ -219,6 +618,117 @@ static void handle_vcpu(bool skip, CpuMessage::Type type, VCpu *vcpu, CpuState *
 }
 
 
+/**
+ * A present paging-structure entry in guest RAM.
+ */
+template <typename PTE>
+static PTE *ram_pte(uintptr_t phys, PTE &value)
+{
+  if (phys > ram_size - sizeof(PTE)) return nullptr;
+  PTE *ptr = reinterpret_cast<PTE *>(ram + phys);
+  value = __atomic_load_n(ptr, __ATOMIC_RELAXED);
+  return value & 1 ? ptr : nullptr;
+}
+
+/**
+ * Translate an instruction fetch with 32-bit or PAE paging like the
+ * executor's MemTlb and set the accessed bits on success.  Faults,
+ * reserved bits and SMEP violations are left to the slow path.
+ */
+template <typename PTE>
+static bool fetch_translate(CpuState *cpu, uintptr_t lin, uintptr_t &phys)
+{
+  const bool pae = sizeof(PTE) == 8;
+  const unsigned bits = pae ? 9 : 10;
+  PTE *ptr[2];
+  PTE  pte;
+  uintptr_t table = cpu->cr3 & ~0xfff;
+
+  if (pae) {
+    unsigned long long pdpte;
+    if (!ram_pte((cpu->cr3 & ~0x1f) + ((lin >> 30) & 3) * 8, pdpte)
+        || pdpte & 0x1e6 || pdpte >> PHYS_ADDR_SIZE)
+      return false;
+    table = pdpte & ~0xfffull;
+  }
+
+  unsigned user = 4;
+  unsigned levels = 0;
+  for (unsigned shift = 12 + bits; ; shift -= bits) {
+    ptr[levels] = ram_pte(table + ((lin >> shift) & ((1u << bits) - 1)) * sizeof(PTE), pte);
+    if (!ptr[levels++] || (static_cast<unsigned long long>(pte) >> PHYS_ADDR_SIZE)) return false;
+    user &= pte;
+
+    if (shift == 12) {
+      phys = (pte & ~0xfffull) | (lin & 0xfff);
+      break;
+    }
+    if (pte & 0x80 && (pae || cpu->cr4 & 0x10)) {
+      // large pages above 4G or with reserved bits
+      if (pte & (pae ? 0x1fe000 : 0x3fe000)) return false;
+      phys = (pte & ~((PTE(1) << shift) - 1)) | (lin & ((1ul << shift) - 1));
+      break;
+    }
+    table = pte & ~0xfffull;
+  }
+
+  // CPL 3 needs a user page, SMEP keeps the kernel from running one
+  if (cpu->cpl() == 3 ? !user : (user && cpu->cr4 & (1 << 20))) return false;
+
+  for (unsigned i = 0; i < levels; i++)
+    if (~*ptr[i] & 0x20) __atomic_fetch_or(ptr[i], PTE(0x20), __ATOMIC_RELAXED);
+  return true;
+}
+
+/**
+ * Execute an "in" from a port with a lock-free reader, e.g. the PIT
+ * or the PM timer, without taking irq_mtx.  Everything but a plain
+ * "in al/ax/eax" with at most an operand-size prefix goes the slow
+ * path.
+ */
+static bool fast_port_in(VCpu *vcpu, CpuState *cpu)
+{
+  if (cpu->intr_state & 3 || cpu->actv_state || cpu->inj_info & 0x80000000
+      || cpu->efl & 0x100 || cpu->dr7 & 0xff || cpu->v86()
+      || (cpu->pm() && cpu->cpl() > cpu->iopl())
+      || cpu->eip >= cpu->cs.limit
+      || VCpu::in_bios_window(cpu) || vcpu->event_pending(cpu))
+    return false;
+
+  // the longest instruction is "66 e5 ib"
+  uintptr_t lin  = (cpu->cs.base + cpu->eip) & 0xffffffff;
+  uintptr_t phys = lin;
+  if ((lin & 0xfff) > 0xffd) return false;
+  if (cpu->pg() && !(cpu->cr4 & 0x20 ? fetch_translate<unsigned long long>(cpu, lin, phys)
+                                     : fetch_translate<unsigned>(cpu, lin, phys)))
+    return false;
+  if (phys > ram_size - 3) return false;
+
+  const unsigned char *code = reinterpret_cast<unsigned char *>(ram + phys);
+  unsigned operand_size = ((cpu->cs.ar >> 10) & 1) + 1;
+  unsigned port, len = 0;
+  if (code[len] == 0x66) { operand_size ^= 3; len++; }
+  switch (code[len]) {
+  case 0xe4: port = code[len + 1]; operand_size = 0; len += 2; break; // in al, imm8
+  case 0xe5: port = code[len + 1];                   len += 2; break; // in ax/eax, imm8
+  case 0xec: port = cpu->dx;       operand_size = 0; len += 1; break; // in al, dx
+  case 0xed: port = cpu->dx;                         len += 1; break; // in ax/eax, dx
+  default:   return false;
+  }
+  if (cpu->eip + len - 1 > cpu->cs.limit) return false;
+
+  MessageIOIn msg(MessageIOIn::Type(operand_size), port);
+  if (!mb.bus_ioin.send_fast(msg)) return false;
+  COUNTER_INC("fast in");
+  switch (operand_size) {
+  case 0: cpu->al  = msg.value; break;
+  case 1: cpu->ax  = msg.value; break;
+  case 2: cpu->eax = msg.value; break;
+  }
+  cpu->eip += len;
+  return true;
+}
+
 static void *vcpu_thread_fn(void *arg)
 {
   VCpu * vcpu = static_cast<VCpu *>(arg);
@@ -230,9 +740,12 @@ static void *vcpu_thread_fn(void *arg)
   pthread_mutex_unlock(&irq_mtx);
 
   while (true) {
+    if (fast_port_in(vcpu, &cpu_state)) continue;
+
     pthread_mutex_lock(&irq_mtx);
     handle_vcpu(false, CpuMessage::TYPE_SINGLE_STEP, vcpu, &cpu_state);
     // Logging::printf("eip %x\n", cpu_state.eip);
+    disk_flush();
     pthread_mutex_unlock(&irq_mtx);
   }
 
@@ -243,9 +756,13 @@ static void *vcpu_thread_fn(void *arg)
 struct  Vcpu_info {
   pthread_t tid;
   sem_t     block;
+  bool      blocked;
 };
 
 static std::vector<Vcpu_info> vcpu_info;
+static unsigned               idle_vcpus;
+
+static bool timeout_skip();
 
 static bool receive(Device *, MessageHostOp &msg)
 {
@@ -280,16 +797,47 @@ static bool receive(Device *, MessageHostOp &msg)
       }
       pthread_setname_np(vcpu_info[msg.value].tid, "vcpu");
 
+      char role[16];
+      snprintf(role, sizeof(role), "vcpu%lu", msg.value);
+      place_thread(vcpu_info[msg.value].tid, role, "vcpu");
       break;
     }
-    case MessageHostOp::OP_VCPU_BLOCK:
+    case MessageHostOp::OP_VCPU_BLOCK: {
+      Vcpu_info &info = vcpu_info[msg.value];
+      info.blocked = true;
+      idle_vcpus++;
+
+      // The disk requests we wait for have to be issued first.  Their
+      // commits may already release us.
+      disk_flush();
+
+      // Nobody can wake us up, except a timeout.
+      while (virtual_time && idle_vcpus == vcpu_info.size() && timeout_skip()) {}
+
       pthread_mutex_unlock(&irq_mtx);
-      sem_wait(&vcpu_info[msg.value].block);
+      sem_wait(&info.block);
       pthread_mutex_lock(&irq_mtx);
+      if (info.blocked) {
+        info.blocked = false;
+        idle_vcpus--;
+      }
       break;
+    }
     case MessageHostOp::OP_VCPU_RELEASE:
+      if (vcpu_info[msg.value].blocked) {
+        vcpu_info[msg.value].blocked = false;
+        idle_vcpus--;
+      }
       sem_post(&vcpu_info[msg.value].block);
       break;
+    case MessageHostOp::OP_REVOKE_MEMREGION:
+      // Guest memory is never mapped into a hardware page table here,
+      // thus only the instruction emulators hold references to it.
+      for (VCpu *vcpu = mb.last_vcpu; vcpu; vcpu = vcpu->get_last()) {
+        CpuMessage cmsg(CpuMessage::TYPE_REVOKE_MEMREGION, nullptr, 0);
+        vcpu->executor.send(cmsg);
+      }
+      break;
     case MessageHostOp::OP_GET_MODULE:
       // For historical reasons, modules numbers start with 1.
       msg.module --;
@@ -332,12 +880,30 @@ static void timeout_trigger()
   // timer, if the timeout event reached us too early.
   last_to = ~0ULL;
 
-  // trigger all timeouts that are due
+  // collect all timeouts that are due and deliver them as a batch
+  struct {
+    TimerOwner *owner;
+    unsigned    nr;
+    timevalue   time;
+  } due[MAX_TIMERS];
+  unsigned count = 0;
   unsigned nr;
-  while ((nr = timeouts.trigger(now))) {
-    MessageTimeout msg(nr, timeouts.timeout());
+  TimerOwner *owner;
+  while ((nr = timeouts.trigger(now, &owner))) {
+    due[count].owner = owner;
+    due[count].nr    = nr;
+    due[count].time  = timeouts.timeout();
+    count++;
     timeouts.cancel(nr);
-    mb.bus_timeout.send(msg);
+  }
+
+  // timers with an owner do not need the broadcast
+  for (unsigned i = 0; i < count; i++) {
+    MessageTimeout msg(due[i].nr, due[i].time);
+    if (due[i].owner)
+      due[i].owner->func(due[i].owner->dev, msg);
+    else
+      mb.bus_timeout.send(msg);
   }
 }
 
@@ -371,6 +937,22 @@ static void timeout_request()
   }
 }
 
+/**
+ * Advance the clock to the next timeout and trigger it.  Returns
+ * false if there is no timeout pending.
+ */
+static bool timeout_skip()
+{
+  timevalue next_to = timeouts.timeout();
+  if (next_to == ~0ULL) return false;
+
+  timevalue now = mb_clock.time();
+  if (next_to > now) mb_clock.advance(next_to - now);
+  timeout_trigger();
+  timeout_request();
+  return true;
+}
+
 static void timeout_handler_fn(union sigval)
 {
   pthread_mutex_lock(&irq_mtx);
@@ -384,7 +966,7 @@ static bool receive(Device *, MessageTimer &msg)
   switch (msg.type)
     {
     case MessageTimer::TIMER_NEW:
-      msg.nr = timeouts.alloc();
+      msg.nr = timeouts.alloc(msg.func ? new TimerOwner { msg.dev, msg.func } : nullptr);
       return true;
     case MessageTimer::TIMER_REQUEST_TIMEOUT:
       timeouts.request(msg.nr, msg.abstime);
@@ -456,43 +1038,140 @@ static bool receive(Device *, MessageNetwork &msg)
 
 }
 
+// Queued disk requests. Their DMA descriptors are already translated
+// to host memory in disk_iov.
+struct DiskRequest {
+  unsigned            disknr;
+  MessageDisk::Type   type;
+  unsigned long long  sector;
+  unsigned long       usertag;
+  size_t              first;    // first entry in disk_iov
+  unsigned            count;    // number of entries in disk_iov
+  size_t              bytes;
+  MessageDisk::Status status;
+};
+
+static std::vector<DiskRequest>  disk_queue;
+static std::vector<struct iovec> disk_iov;
+
+static bool disk_mergeable(const DiskRequest &r)
+{
+  return r.status == MessageDisk::DISK_OK and r.type != MessageDisk::DISK_FLUSH_CACHE
+    and !(r.bytes & 511);
+}
+
+/**
+ * Issue all queued disk requests. Requests that continue the previous
+ * one on the same disk are merged into a single host I/O. Commits are
+ * sent in the order the requests were queued.
+ */
+static void disk_flush()
+{
+  // Commits may queue new requests.
+  while (!disk_queue.empty()) {
+    std::vector<DiskRequest>  queue;
+    std::vector<struct iovec> iov;
+    queue.swap(disk_queue);
+    iov.swap(disk_iov);
+
+    for (size_t i = 0; i < queue.size(); ) {
+      const DiskRequest &first = queue[i];
+      size_t   n     = 1;
+      unsigned count = first.count;
+      size_t   bytes = first.bytes;
+
+      while (disk_mergeable(first) and i + n < queue.size()) {
+        const DiskRequest &next = queue[i + n];
+        if (!disk_mergeable(next) or next.disknr != first.disknr or next.type != first.type or
+            next.sector != first.sector + (bytes >> 9) or count + next.count > IOV_MAX)
+          break;
+        count += next.count;
+        bytes += next.bytes;
+        n++;
+      }
+
+      Disk &disk = disks[first.disknr];
+      if (first.type == MessageDisk::DISK_FLUSH_CACHE) {
+        // with writethrough, there is nothing to flush
+        if (disk.cache != Disk::CACHE_WRITETHROUGH and fdatasync(disk.fd)) {
+          perror("fdatasync");
+          queue[i].status = MessageDisk::DISK_STATUS_DEVICE;
+        }
+      } else if (count and first.type == MessageDisk::DISK_READ and
+                 disk.is_hole(first.sector << 9, (first.sector << 9) + bytes)) {
+        // nothing allocated: zero the guest buffers without a syscall
+        for (unsigned j = 0; j < count; j++)
+          memset(iov[first.first + j].iov_base, 0, iov[first.first + j].iov_len);
+        COUNTER_INC("disk hole");
+      } else if (count) {
+        if (first.type == MessageDisk::DISK_WRITE)
+          disk.mark_data(first.sector << 9, (first.sector << 9) + bytes);
+        ssize_t res = disk_io(disk, first.type == MessageDisk::DISK_READ, &iov[first.first], count, first.sector << 9);
+
+        // The last sector of an image may be partial and reads as zero.
+        struct stat st;
+        if (first.type == MessageDisk::DISK_READ and res >= 0 and res < ssize_t(bytes) and
+            0 == fstat(disk.fd, &st) and off_t((first.sector << 9) + res) >= st.st_size) {
+          iov_zero(&iov[first.first], count, res);
+          res = bytes;
+        }
+
+        if (res < ssize_t(bytes)) {
+          Logging::printf("short read/write: %zd instead of %zu\n", res, bytes);
+
+          // fail the requests that were not transferred completely
+          size_t end = 0;
+          for (size_t j = i; j < i + n; j++) {
+            end += queue[j].bytes;
+            if (res < 0 or end > size_t(res)) queue[j].status = MessageDisk::DISK_STATUS_DEVICE;
+          }
+        }
+        if (n > 1) COUNTER_INC("disk merged");
+      }
+
+      for (size_t j = i; j < i + n; j++) {
+        MessageDiskCommit cmsg(queue[j].disknr, queue[j].usertag, queue[j].status);
+        mb.bus_diskcommit.send(cmsg);
+      }
+      i += n;
+    }
+  }
+}
+
+/**
+ * Disk requests are queued and issued by disk_flush() at the end of
+ * the vCPU exit, so that runs of small sequential requests can be
+ * merged.
+ */
 static bool receive(Device *, MessageDisk &msg)
 {
   if (msg.disknr >= disks.size()) return false;
 
-  Disk               &disk   = disks[msg.disknr];
-  MessageDisk::Status status = MessageDisk::DISK_OK;
-  unsigned long long  offset = msg.sector << 9;
+  Disk       &disk = disks[msg.disknr];
+  DiskRequest req  = { msg.disknr, msg.type, 0, 0, disk_iov.size(), 0, 0, MessageDisk::DISK_OK };
 
   switch (msg.type) {
   case MessageDisk::DISK_READ:
   case MessageDisk::DISK_WRITE:
+    req.sector  = msg.sector;
+    req.usertag = msg.usertag;
     for (unsigned i=0; i < msg.dmacount; i++) {
-      size_t  start = offset;
-      size_t  end   = start + msg.dma[i].bytecount;
-      ssize_t bytes;
+      size_t start = (msg.sector << 9) + req.bytes;
+      size_t end   = start + msg.dma[i].bytecount;
 
       if (end > disk.size or start > disk.size or
           msg.dma[i].byteoffset > msg.physsize or
-          msg.dma[i].byteoffset + msg.dma[i].bytecount > msg.physsize) {
-        status = MessageDisk::Status(MessageDisk::DISK_STATUS_DEVICE |
-                                     (i << MessageDisk::DISK_STATUS_SHIFT));
+          msg.dma[i].byteoffset + msg.dma[i].bytecount > msg.physsize or
+          msg.dma[i].byteoffset + msg.dma[i].bytecount > ram_mapped) {
+        req.status = MessageDisk::Status(MessageDisk::DISK_STATUS_DEVICE |
+                                         (i << MessageDisk::DISK_STATUS_SHIFT));
         break;
       }
 
-      // XXX Workaround, use hostop GUEST_MEM.
-      msg.physoffset = reinterpret_cast<uintptr_t>(ram);
-
-      typedef int (*RWFn)(int,void *,size_t,off_t);
-      bytes = ((msg.type == MessageDisk::DISK_READ) ? (RWFn)pread : (RWFn)pwrite)
-        (disk.fd, reinterpret_cast<void *>(msg.dma[i].byteoffset + msg.physoffset),
-         end - start, start);
-
-      if (bytes < ssize_t(end - start)) {
-        Logging::printf("short read/write: %zd instead of %zd\n", bytes, end - start);
-      }
-
-      offset += end - start;
+      struct iovec v = { ram + msg.dma[i].byteoffset, msg.dma[i].bytecount };
+      disk_iov.push_back(v);
+      req.count++;
+      req.bytes += msg.dma[i].bytecount;
     }
     break;
   case MessageDisk::DISK_GET_PARAMS:
@@ -505,21 +1184,24 @@ static bool receive(Device *, MessageDisk &msg)
       return true;
     }
   case MessageDisk::DISK_FLUSH_CACHE:
+    // keeps its place in the queue, thus all writes before are done
+    req.usertag = msg.usertag;
     break;
   default:
     assert(0);
   }
 
-  MessageDiskCommit cmsg(msg.disknr, msg.usertag, status);
-  mb.bus_diskcommit.send(cmsg);
-
+  disk_queue.push_back(req);
   return true;
 }
 
 static void usage()
 {
-  fprintf(stderr, "Usage: seoul [-m RAM] [-n tap-device] [-d disk-image]\n"
-                  "             [kernel parameters] [module1 parameters] ...\n");
+  fprintf(stderr, "Usage: seoul [-m RAM] [-n tap-device] [-s switch-socket] [-p host-interface]\n"
+                  "             [-d disk-image[,cache=writeback|writethrough|direct]] [-b] [-v]\n"
+                  "             [-A role=cpus] [-R role=prio] [-L]\n"
+                  "             [kernel parameters] [module1 parameters] ...\n"
+                  "Roles are vcpu, vcpuN, io and timer.\n");
   exit(EXIT_FAILURE);
 }
 
@@ -535,7 +1217,9 @@ int main(int argc, char **argv)
   }
 
   int ch;
-  while ((ch = getopt(argc, argv, "hm:n:d:")) != -1) {
+  bool direct_boot = false;
+  std::vector<std::string> backends;
+  while ((ch = getopt(argc, argv, "hm:n:s:p:d:bvA:R:L")) != -1) {
     switch (ch) {
     case 'm':
       ram_size = atoi(optarg) << 20;
@@ -547,8 +1231,46 @@ int main(int argc, char **argv)
         return EXIT_FAILURE;
       }
       break;
-    case 'd':
-      disks.push_back(Disk::from_file(optarg));
+    case 's':
+      // Attach the network to a packet switch via shared memory.
+      backends.push_back(std::string("shmnet:") + optarg);
+      break;
+    case 'p':
+      // Attach the network to a host interface via AF_PACKET rings.
+      backends.push_back(std::string("afpacket:") + optarg);
+      break;
+    case 'd': {
+      // An optional ",cache=mode" suffix selects the caching mode.
+      Disk::Cache cache = Disk::CACHE_WRITEBACK;
+      char *suffix = strstr(optarg, ",cache=");
+      if (suffix) {
+        if (!Disk::parse_cache(suffix + 7, cache)) {
+          fprintf(stderr, "Invalid cache mode '%s'.\n", suffix + 7);
+          usage();
+        }
+        *suffix = 0;
+      }
+      disks.push_back(Disk::from_file(optarg, cache));
+      break;
+    }
+    case 'b':
+      // Start the kernel without running the BIOS.
+      direct_boot = true;
+      break;
+    case 'v':
+      // Run on virtual time: idle periods are skipped.
+      virtual_time = true;
+      break;
+    case 'A':
+    case 'R':
+      // Pin threads to host CPUs or run them with SCHED_FIFO.
+      if (!parse_placement(optarg, ch == 'R')) {
+        fprintf(stderr, "Invalid placement '%s'.\n", optarg);
+        usage();
+      }
+      break;
+    case 'L':
+      lock_memory = true;
       break;
     case 'h':
     case '?':
@@ -575,11 +1297,18 @@ int main(int argc, char **argv)
     perror("mmap");
     return EXIT_FAILURE;
   }
+  ram_mapped = ram_size;
+
+  if (lock_memory and mlockall(MCL_CURRENT | MCL_FUTURE)) {
+    perror("mlockall");
+    lock_memory = false;
+  }
 
   // Creating timer. I hate C++: No useful initializers...
   struct sigevent ev;
   ev.sigev_notify            = SIGEV_THREAD;
-  ev.sigev_notify_attributes = NULL;
+  init_timer_attr();
+  ev.sigev_notify_attributes = &timer_attr;
   ev.sigev_notify_function   = timeout_handler_fn;
 
   if (0 != timer_create(CLOCK_MONOTONIC, &ev, &timer_id)) {
@@ -603,9 +1332,12 @@ int main(int argc, char **argv)
   pthread_mutex_lock(&irq_mtx);
 
   // Create standard PC
+  if (direct_boot) mb.handle_arg("vbios_multiboot_direct");
   for (const char **dev = pc_ps2; *dev != NULL; dev++) {
     mb.handle_arg(*dev);
   }
+  for (const std::string &b : backends)
+    mb.handle_arg(b.c_str());
 
   Logging::printf("Devices and %zu virtual CPU%s started successfully.\n",
                   vcpu_info.size(), vcpu_info.size() == 1 ? "" : "s");
@@ -643,8 +1375,11 @@ int main(int argc, char **argv)
       return EXIT_FAILURE;
     }
     pthread_setname_np(iothread, "io");
+    place_thread(iothread, "io", "io");
   }
 
+  report_placement();
+
   Logging::printf("Virtual CPUs starting.\n");
   pthread_mutex_unlock(&irq_mtx);
 
@@ -0,0 +1,176 @@
+/**
+ * Shared-memory network backend
+ *
+ * Economic rights: Technische Universitaet Dresden (Germany)
+ *
+ * This file is part of Seoul.
+ *
+ * Seoul is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Seoul is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+#include <nul/motherboard.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+
+#include <seoul/unix.h>
+#include <seoul/shmring.h>
+
+/**
+ * Connects bus_network to a packet switch via shared-memory rings.
+ *
+ * Packets are copied once into the ring on send and handed to the
+ * network models directly from the ring on receive.  Syscalls are
+ * only needed to wake up a side that went to sleep.
+ */
+class ShmNetwork : public StaticReceiver<ShmNetwork>
+{
+  enum { RX_BATCH = 32 };
+
+  DBus<MessageNetwork> &_bus_network;
+  ShmNetRegion *_region;
+  int           _kick_switch;
+  int           _kick_self;
+  unsigned      _tx_dropped;
+
+  void kick(int fd)
+  {
+    uint64_t value = 1;
+    if (write(fd, &value, sizeof(value)) != sizeof(value)) perror("shmnet: kick");
+  }
+
+  bool own_packet(const unsigned char *buffer)
+  {
+    const unsigned char *start = reinterpret_cast<unsigned char *>(&_region->from_switch.slots);
+    return buffer >= start && buffer < start + sizeof(_region->from_switch.slots);
+  }
+
+public:
+
+  bool receive(MessageNetwork &msg)
+  {
+    if (msg.type != MessageNetwork::PACKET || own_packet(msg.buffer)) return false;
+
+    ShmPacketRing &ring = _region->to_switch;
+    ShmPacketRing::Slot *slot = ring.produce_slot();
+    if (!slot || msg.len > ShmPacketRing::MAX_PACKET) {
+      if (!(_tx_dropped++ & 0xff)) Logging::printf("shmnet: dropped %u packets\n", _tx_dropped);
+      return false;
+    }
+    memcpy(slot->data, msg.buffer, msg.len);
+    ring.produce(msg.len);
+    if (ring.need_kick()) kick(_kick_switch);
+    return true;
+  }
+
+
+  /**
+   * Deliver packets from the switch.  The irq_mtx is taken once per
+   * batch instead of once per packet.
+   */
+  static void *rx_thread_fn(void *arg)
+  {
+    ShmNetwork    *n = reinterpret_cast<ShmNetwork *>(arg);
+    ShmPacketRing &ring = n->_region->from_switch;
+
+    while (true) {
+      unsigned len;
+      if (ring.peek(len)) {
+        pthread_mutex_lock(&irq_mtx);
+        ShmPacketRing::Slot *slot;
+        for (unsigned i = 0; i < RX_BATCH && (slot = ring.peek(len)); i++) {
+          MessageNetwork msg(slot->data, len, 0);
+          n->_bus_network.send(msg);
+          ring.consume();
+        }
+        pthread_mutex_unlock(&irq_mtx);
+        continue;
+      }
+
+      if (!ring.prepare_sleep()) continue;
+      uint64_t value;
+      if (read(n->_kick_self, &value, sizeof(value)) != sizeof(value)) break;
+      ring.wakeup();
+    }
+    return nullptr;
+  }
+
+
+  /**
+   * Create the shared region and hand it to the switch listening on path.
+   */
+  bool connect(const char *path, size_t len)
+  {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (len >= sizeof(addr.sun_path)) return false;
+    memcpy(addr.sun_path, path, len);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int mem  = memfd_create("seoul-shmnet", MFD_CLOEXEC);
+    _kick_switch = eventfd(0, EFD_CLOEXEC);
+    _kick_self   = eventfd(0, EFD_CLOEXEC);
+    if (sock < 0 || mem < 0 || _kick_switch < 0 || _kick_self < 0
+        || ftruncate(mem, sizeof(ShmNetRegion))) {
+      perror("shmnet: setup");
+      return false;
+    }
+
+    void *ptr = mmap(nullptr, sizeof(ShmNetRegion), PROT_READ | PROT_WRITE, MAP_SHARED, mem, 0);
+    if (ptr == MAP_FAILED) { perror("shmnet: mmap"); return false; }
+    _region = reinterpret_cast<ShmNetRegion *>(ptr);
+    _region->magic   = ShmNetRegion::MAGIC;
+    _region->version = ShmNetRegion::VERSION;
+    _region->to_switch.init();
+    _region->from_switch.init();
+
+    if (::connect(sock, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr))) {
+      perror("shmnet: connect");
+      return false;
+    }
+
+    ShmNetHello hello = { ShmNetRegion::MAGIC, ShmNetRegion::VERSION, sizeof(ShmNetRegion) };
+    const int fds[ShmNetHello::FDS] = { mem, _kick_switch, _kick_self };
+    if (!hello.send(sock, fds)) {
+      perror("shmnet: handshake");
+      return false;
+    }
+
+    // The switch keeps its own references.  The socket stays open,
+    // so that the switch notices when we are gone.
+    close(mem);
+    return true;
+  }
+
+  ShmNetwork(DBus<MessageNetwork> &bus_network)
+    : _bus_network(bus_network), _region(), _kick_switch(-1), _kick_self(-1), _tx_dropped() {}
+};
+
+
+PARAM_HANDLER(shmnet,
+              "shmnet:path - connect the network to the packet switch listening on the UNIX socket path.")
+{
+  ShmNetwork *n = new ShmNetwork(mb.bus_network);
+  if (!n->connect(args, args_len)) Logging::panic("shmnet: could not attach to '%.*s'\n", int(args_len), args);
+
+  mb.bus_network.add(n, ShmNetwork::receive_static<MessageNetwork>);
+
+  pthread_t p;
+  if (pthread_create(&p, NULL, ShmNetwork::rx_thread_fn, n)) Logging::panic("shmnet: could not create thread\n");
+  pthread_setname_np(p, "shmnet");
+  place_thread(p, "shmnet", "io");
+}
+
+// EOF
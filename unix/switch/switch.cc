@@ -0,0 +1,238 @@
+/**
+ * Reference packet switch for the shared-memory network backend
+ *
+ * Economic rights: Technische Universitaet Dresden (Germany)
+ *
+ * This file is part of Seoul.
+ *
+ * Seoul is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Seoul is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License version 2 for more details.
+ */
+
+// A learning Ethernet switch.  Every Seoul instance started with
+// "-s socket" becomes one port.  Unknown destinations, broadcast and
+// multicast frames are flooded to all other ports.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/un.h>
+
+#include <seoul/shmring.h>
+
+enum {
+  MAX_PORTS   = 16,
+  MAC_ENTRIES = 256,
+  BATCH       = 64,
+  TAG_LISTEN  = ~0u,
+  TAG_SOCKET  = 1u << 16,
+};
+
+struct Port {
+  int           sock;
+  int           kick_in;  // kicks us when the port sent packets
+  int           kick_out; // kicks the port when we delivered packets
+  ShmNetRegion *region;
+  bool          dirty;    // delivered packets since the last kick
+  unsigned long forwarded;
+  unsigned long dropped;
+};
+
+struct MacEntry {
+  uint64_t mac;
+  unsigned port;
+};
+
+static Port     ports[MAX_PORTS];
+static MacEntry macs[MAC_ENTRIES];
+static int      epfd;
+
+static uint64_t read_mac(const unsigned char *p)
+{
+  uint64_t mac = 0;
+  memcpy(&mac, p, 6);
+  return mac;
+}
+
+// A collision only means that the destination is flooded.
+static MacEntry &mac_entry(uint64_t mac) { return macs[((mac * 0x9e3779b97f4a7c15ull) >> 32) % MAC_ENTRIES]; }
+
+static void kick(int fd)
+{
+  uint64_t value = 1;
+  if (write(fd, &value, sizeof(value)) != sizeof(value)) perror("kick");
+}
+
+static void deliver(unsigned to, const ShmPacketRing::Slot *packet, unsigned len)
+{
+  Port &p = ports[to];
+  ShmPacketRing::Slot *slot = p.region->from_switch.produce_slot();
+  if (!slot) { p.dropped++; return; }
+  memcpy(slot->data, packet->data, len);
+  p.region->from_switch.produce(len);
+  p.forwarded++;
+  p.dirty = true;
+}
+
+static void forward(unsigned from, const ShmPacketRing::Slot *packet, unsigned len)
+{
+  if (len < 14) return;
+
+  // learn the source, unless it is a multicast address
+  uint64_t src = read_mac(packet->data + 6);
+  if (~packet->data[6] & 1) {
+    MacEntry &e = mac_entry(src);
+    e.mac  = src;
+    e.port = from;
+  }
+
+  uint64_t dst = read_mac(packet->data);
+  MacEntry &e = mac_entry(dst);
+  if (~packet->data[0] & 1 && e.mac == dst && ports[e.port].region) {
+    if (e.port != from) deliver(e.port, packet, len);
+    return;
+  }
+  for (unsigned i = 0; i < MAX_PORTS; i++)
+    if (i != from && ports[i].region) deliver(i, packet, len);
+}
+
+static void flush_kicks()
+{
+  for (unsigned i = 0; i < MAX_PORTS; i++)
+    if (ports[i].dirty) {
+      ports[i].dirty = false;
+      if (ports[i].region->from_switch.need_kick()) kick(ports[i].kick_out);
+    }
+}
+
+static void drain(unsigned port)
+{
+  ShmPacketRing &ring = ports[port].region->to_switch;
+  ring.wakeup();
+  do {
+    ShmPacketRing::Slot *packet;
+    unsigned len;
+    for (unsigned i = 0; i < BATCH && (packet = ring.peek(len)); i++) {
+      forward(port, packet, len);
+      ring.consume();
+    }
+    flush_kicks();
+  } while (!ring.prepare_sleep());
+}
+
+static void close_port(unsigned port)
+{
+  Port &p = ports[port];
+  printf("port %u: closed, %lu forwarded, %lu dropped\n", port, p.forwarded, p.dropped);
+  close(p.sock);
+  close(p.kick_in);
+  close(p.kick_out);
+  munmap(p.region, sizeof(ShmNetRegion));
+  for (unsigned i = 0; i < MAC_ENTRIES; i++)
+    if (macs[i].port == port) macs[i].mac = 0;
+  memset(&p, 0, sizeof(p));
+}
+
+static void accept_port(int listen_fd)
+{
+  int sock = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+  if (sock < 0) { perror("accept"); return; }
+
+  unsigned port;
+  for (port = 0; port < MAX_PORTS && ports[port].region; port++) {}
+
+  ShmNetHello hello;
+  int fds[ShmNetHello::FDS] = { -1, -1, -1 };
+  void *region = MAP_FAILED;
+  if (port < MAX_PORTS && hello.recv(sock, fds))
+    region = mmap(nullptr, sizeof(ShmNetRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+
+  if (region == MAP_FAILED) {
+    fprintf(stderr, "rejecting connection\n");
+    for (unsigned i = 0; i < ShmNetHello::FDS; i++) if (fds[i] >= 0) close(fds[i]);
+    close(sock);
+    return;
+  }
+  close(fds[0]);
+
+  Port &p = ports[port];
+  p.sock     = sock;
+  p.kick_in  = fds[1];
+  p.kick_out = fds[2];
+  p.region   = reinterpret_cast<ShmNetRegion *>(region);
+
+  struct epoll_event ev;
+  ev.events   = EPOLLIN;
+  ev.data.u32 = port;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, p.kick_in, &ev);
+  ev.data.u32 = port | TAG_SOCKET;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, p.sock, &ev);
+  printf("port %u: connected\n", port);
+
+  // packets may have been queued before we listened
+  drain(port);
+}
+
+int main(int argc, char **argv)
+{
+  if (argc != 2) {
+    fprintf(stderr, "Usage: seoul-switch socket-path\n");
+    return EXIT_FAILURE;
+  }
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, argv[1], sizeof(addr.sun_path) - 1);
+  unlink(addr.sun_path);
+
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd < 0
+      || bind(listen_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr))
+      || listen(listen_fd, MAX_PORTS)) {
+    perror("listen");
+    return EXIT_FAILURE;
+  }
+
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+  struct epoll_event ev;
+  ev.events   = EPOLLIN;
+  ev.data.u32 = TAG_LISTEN;
+  if (epfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev)) {
+    perror("epoll");
+    return EXIT_FAILURE;
+  }
+  printf("Switch listening on %s.\n", addr.sun_path);
+
+  while (true) {
+    struct epoll_event events[MAX_PORTS];
+    int n = epoll_wait(epfd, events, MAX_PORTS, -1);
+    if (n < 0) { perror("epoll_wait"); continue; }
+
+    for (int i = 0; i < n; i++) {
+      unsigned tag = events[i].data.u32;
+      if (tag == TAG_LISTEN)       accept_port(listen_fd);
+      else if (tag & TAG_SOCKET) {
+        // Seoul never sends anything after the hello: this is a hangup.
+        if (ports[tag & ~TAG_SOCKET].region) close_port(tag & ~TAG_SOCKET);
+      }
+      else if (ports[tag].region) {
+        uint64_t value;
+        if (read(ports[tag].kick_in, &value, sizeof(value)) < 0) perror("read kick");
+        drain(tag);
+      }
+    }
+  }
+}
+
+// EOF